@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "accesslog.h"
+
+/* writer 스레드가 ring이 모두 비었을 때 쉬는 시간 */
+#define ALOG_IDLE_USEC 10000
+/* 한 번의 writev로 내보낼 최대 레코드 수 */
+#define ALOG_BATCH 256
+/* JSON 한 줄 최대 길이 (URL escape 최악의 경우 포함) */
+#define ALOG_LINE_MAX (ALOG_URL_MAX * 6 + 256)
+
+/*
+ * slot 하나의 ring buffer (single producer - single consumer)
+ * producer : 그 slot을 가진 연결 스레드 (한 번에 하나) -> tail만 씀
+ * consumer : writer 스레드 -> head만 씀
+ * head와 tail을 다른 cache line에 두어 서로 invalidate하지 않도록 한다.
+ */
+typedef struct {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    _Alignas(64) alog_rec_t recs[ALOG_RING_LEN];
+} alog_ring_t;
+
+/* ------------ global var ------------ */
+static int alog_fd = -1;
+static int alog_nrings;
+static _Atomic(alog_ring_t *) *alog_rings;  /* slot 별 ring, 처음 쓸 때 할당 */
+static atomic_long alog_dropped;            /* ring이 꽉 차서 버린 레코드 수 */
+static pthread_mutex_t alog_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *alog_writer(void *vargp);
+
+/* ------------ routine ------------ */
+/*
+ * path 파일에 append 모드로 로그를 남기도록 초기화하고 writer 스레드 시작
+ * nrings : 동시에 로그를 쓰는 slot 수 (연결 slot 수와 같게)
+ */
+int alog_init(const char *path, int nrings) {
+  pthread_t tid;
+
+  if ((alog_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+    return -1;
+  alog_nrings = nrings;
+  alog_rings = calloc(nrings, sizeof(*alog_rings));
+  if (alog_rings == NULL || pthread_create(&tid, NULL, alog_writer, NULL) != 0) {
+    close(alog_fd);
+    alog_fd = -1;
+    return -1;
+  }
+  pthread_detach(tid);
+  return 0;
+}
+
+int alog_enabled(void) {
+  return alog_fd >= 0;
+}
+
+/* 연결 스레드 쪽 - lock 없이 자기 ring에 복사만 하고 바로 리턴 */
+void alog_write(int ring, const alog_rec_t *rec) {
+  alog_ring_t *r;
+  size_t t, h;
+
+  if (alog_fd < 0 || ring < 0 || ring >= alog_nrings)
+    return;
+  if ((r = atomic_load_explicit(&alog_rings[ring], memory_order_acquire)) == NULL) {
+    /* 이 slot이 처음 쓰임 - slot은 한 번에 한 스레드만 가지므로 경쟁 없음 */
+    if ((r = aligned_alloc(64, sizeof(alog_ring_t))) == NULL)
+      return;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_store_explicit(&alog_rings[ring], r, memory_order_release);
+  }
+
+  t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  h = atomic_load_explicit(&r->head, memory_order_acquire);
+  if (t - h == ALOG_RING_LEN) {
+    /* 꽉 참 - 요청 처리를 막지 않도록 버린다 */
+    atomic_fetch_add_explicit(&alog_dropped, 1, memory_order_relaxed);
+    return;
+  }
+  r->recs[t & (ALOG_RING_LEN - 1)] = *rec;
+  atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+}
+
+/* JSON 문자열 안에 넣을 수 있도록 escape - dst에 쓴 바이트 수 리턴 */
+static size_t json_escape(char *dst, const char *src) {
+  char *p = dst;
+  unsigned char c;
+  for (; (c = (unsigned char)*src) != '\0'; src++) {
+    if (c == '"' || c == '\\') {
+      *p++ = '\\';
+      *p++ = c;
+    } else if (c < 0x20) {
+      p += sprintf(p, "\\u%04x", c);
+    } else
+      *p++ = c;
+  }
+  return p - dst;
+}
+
+/* 레코드 하나 -> JSON 한 줄 */
+static size_t alog_format(char *line, const alog_rec_t *rec) {
+  static const char *cache_str[] = {"NONE", "MISS", "HIT"};
+  size_t n;
+  n = sprintf(line, "{\"ts_usec\":%ld,\"client\":\"%s\",\"url\":\"", rec->ts_usec, rec->client);
+  n += json_escape(line + n, rec->url);
+  n += sprintf(line + n, "\",\"status\":%d,\"bytes\":%zu,\"cache\":\"%s\",\"latency_usec\":%ld}\n",
+               rec->status, rec->bytes, cache_str[rec->cache], rec->latency_usec);
+  return n;
+}
+
+/* iov에 모인 줄들을 전부 파일로 */
+static void alog_writev(struct iovec *iov, int cnt) {
+  ssize_t n;
+  while (cnt > 0) {
+    if ((n = writev(alog_fd, iov, cnt)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return; /* 디스크 에러 - 로그만 잃고 proxy는 계속 */
+    }
+    /* 부분 write면 남은 iov부터 다시 */
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+/*
+ * 모든 ring을 한 바퀴 비움 - 비운 레코드 수 리턴
+ * writer 스레드와 alog_flush만 부르고, 둘 사이는 alog_flush_lock으로 막는다.
+ */
+static long alog_drain(void) {
+  static char lines[ALOG_BATCH][ALOG_LINE_MAX];
+  struct iovec iov[ALOG_BATCH];
+  alog_ring_t *r;
+  size_t h, t;
+  long total = 0;
+  int i, cnt = 0;
+
+  for (i = 0; i < alog_nrings; i++) {
+    if ((r = atomic_load_explicit(&alog_rings[i], memory_order_acquire)) == NULL)
+      continue;
+    h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    t = atomic_load_explicit(&r->tail, memory_order_acquire);
+    for (; h != t; h++) {
+      iov[cnt].iov_base = lines[cnt];
+      iov[cnt].iov_len = alog_format(lines[cnt], &r->recs[h & (ALOG_RING_LEN - 1)]);
+      if (++cnt == ALOG_BATCH) {
+        alog_writev(iov, cnt);
+        total += cnt;
+        cnt = 0;
+      }
+    }
+    /* 레코드는 이미 lines로 포맷(복사)했으니 ring 자리는 바로 돌려준다 */
+    atomic_store_explicit(&r->head, h, memory_order_release);
+  }
+  if (cnt > 0) {
+    alog_writev(iov, cnt);
+    total += cnt;
+  }
+  return total;
+}
+
+/* ring이 꽉 차서 버린 레코드 수 */
+long alog_dropped_count(void) {
+  return atomic_load_explicit(&alog_dropped, memory_order_relaxed);
+}
+
+/* ring에 남은 레코드를 지금 바로 파일로 (종료 직전 등) */
+void alog_flush(void) {
+  if (alog_fd < 0)
+    return;
+  pthread_mutex_lock(&alog_flush_lock);
+  alog_drain();
+  pthread_mutex_unlock(&alog_flush_lock);
+}
+
+/* writer 스레드 - ring이 비어 있으면 잠깐 쉬었다가 다시 확인 */
+static void *alog_writer(void *vargp) {
+  long n;
+  while (1) {
+    pthread_mutex_lock(&alog_flush_lock);
+    n = alog_drain();
+    pthread_mutex_unlock(&alog_flush_lock);
+    if (n == 0)
+      usleep(ALOG_IDLE_USEC);
+  }
+  return NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+#include <stddef.h>
+#include <arpa/inet.h>
+
+/*
+ * 비동기 access log
+ * 연결 스레드는 자기 slot의 ring buffer에 레코드를 넣기만 하고 (lock X),
+ * 백그라운드 writer 스레드가 모든 ring을 비우면서 JSON 한 줄씩 writev로 파일에 쓴다.
+ */
+
+#define ALOG_URL_MAX  256   /* 로그에 남길 URL 최대 길이 (넘으면 자름) */
+#define ALOG_RING_LEN 64    /* slot 하나당 ring에 쌓아둘 수 있는 레코드 수 (2의 거듭제곱) */
+
+/* 캐시 결과 */
+enum { ALOG_CACHE_NONE = 0, ALOG_CACHE_MISS, ALOG_CACHE_HIT };
+
+/* access log 레코드 하나 = 요청 하나 */
+typedef struct {
+    long ts_usec;                     /* 응답을 끝낸 시각 (epoch, usec) */
+    char client[INET6_ADDRSTRLEN];    /* 클라이언트 IP */
+    char url[ALOG_URL_MAX];           /* 요청 URL */
+    int status;                       /* 응답 상태 코드 */
+    int cache;                        /* ALOG_CACHE_* */
+    size_t bytes;                     /* 클라이언트에게 보낸 바이트 수 */
+    long latency_usec;                /* 요청 읽기 시작 ~ 응답 끝 */
+} alog_rec_t;
+
+int  alog_init(const char *path, int nrings);
+int  alog_enabled(void);
+void alog_write(int ring, const alog_rec_t *rec);
+void alog_flush(void);
+long alog_dropped_count(void);
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* 모든 할당은 16바이트 경계로 맞춘다 */
+#define ARENA_ALIGN(n) (((n) + 15) & ~(size_t)15)
+
+/* ------------ routine ------------ */
+void arena_init(arena_t *a, size_t chunk_size) {
+  a->head = NULL;
+  a->chunk_size = chunk_size;
+  a->last = NULL;
+}
+
+/* 새 chunk를 head 앞에 붙인다. 기본 크기보다 큰 요청은 그 크기만큼 따로 잡음 */
+static achunk_t *arena_new_chunk(arena_t *a, size_t size) {
+  achunk_t *c;
+  if (size < a->chunk_size)
+    size = a->chunk_size;
+  if ((c = malloc(sizeof(achunk_t) + size)) == NULL)
+    return NULL;
+  c->size = size;
+  c->used = 0;
+  c->next = a->head;
+  a->head = c;
+  return c;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+  achunk_t *c = a->head;
+  void *p;
+  size = ARENA_ALIGN(size);
+  if (c == NULL || c->size - c->used < size) {
+    if ((c = arena_new_chunk(a, size)) == NULL)
+      return NULL;
+  }
+  p = c->data + c->used;
+  c->used += size;
+  a->last = p;
+  return p;
+}
+
+/*
+ * ptr(old_size)를 new_size로 늘림
+ * ptr이 가장 최근 할당이고 chunk에 자리가 남아 있으면 제자리에서 늘리고,
+ * 아니면 새로 할당해서 복사한다. (예전 자리는 reset 때 같이 반납됨)
+ */
+void *arena_grow(arena_t *a, void *ptr, size_t old_size, size_t new_size) {
+  achunk_t *c = a->head;
+  void *p;
+  if (ptr == NULL)
+    return arena_alloc(a, new_size);
+  if (ptr == a->last && c != NULL) {
+    size_t off = (char *)ptr - c->data;
+    if (c->size - off >= ARENA_ALIGN(new_size)) {
+      c->used = off + ARENA_ALIGN(new_size);
+      return ptr;
+    }
+  }
+  if ((p = arena_alloc(a, new_size)) == NULL)
+    return NULL;
+  memcpy(p, ptr, old_size);
+  return p;
+}
+
+/* 요청 하나가 끝나면 호출 - 기본 크기 chunk 하나만 남기고 전부 반납 */
+void arena_reset(arena_t *a) {
+  achunk_t *c, *keep = NULL;
+  while ((c = a->head) != NULL) {
+    a->head = c->next;
+    if (keep == NULL && c->size == a->chunk_size)
+      keep = c;
+    else
+      free(c);
+  }
+  if (keep != NULL) {
+    keep->used = 0;
+    keep->next = NULL;
+  }
+  a->head = keep;
+  a->last = NULL;
+}
+
+/* 연결이 끝나면 chunk 전부 반납 */
+void arena_destroy(arena_t *a) {
+  achunk_t *c;
+  while ((c = a->head) != NULL) {
+    a->head = c->next;
+    free(c);
+  }
+  a->last = NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/*
+ * 연결 하나가 요청을 처리하는 동안 쓰는 메모리 영역 (bump allocator)
+ * 개별 free 없이 요청이 끝나면 arena_reset으로 한 번에 반납한다.
+ */
+typedef struct achunk {
+    struct achunk *next;
+    size_t size;          /* data 크기 */
+    size_t used;          /* data 중 할당된 바이트 수 */
+    char data[];
+} achunk_t;
+
+typedef struct arena {
+    achunk_t *head;       /* 지금 할당 중인 chunk (가장 최근) */
+    size_t chunk_size;    /* 기본 chunk 크기 */
+    void *last;           /* 가장 최근 할당 - 제자리에서 늘릴 수 있는지 판단용 */
+} arena_t;
+
+void  arena_init(arena_t *a, size_t chunk_size);
+void *arena_alloc(arena_t *a, size_t size);
+void *arena_grow(arena_t *a, void *ptr, size_t old_size, size_t new_size);
+void  arena_reset(arena_t *a);
+void  arena_destroy(arena_t *a);
+
+#endif
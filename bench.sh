@@ -0,0 +1,122 @@
+#!/bin/bash
+#
+# bench.sh - Canned load scenarios for the proxy, driven by ./loadgen.
+#     Starts tiny (serving a generated file set) and the proxy on free
+#     ports, runs one or more scenarios and prints loadgen's report.
+#
+#     usage: ./bench.sh [hit|miss|slow|all] [extra loadgen options]
+#
+#     hit   Zipf(1.1) over 20 small files -> almost every request is a
+#           cache hit after warm-up
+#     miss  uniform over 2000 x 16 KB files (32 MB, far above the 1 MB
+#           cache) -> almost every request goes to tiny
+#     slow  the hit scenario while 8 other connections are stuck on a
+#           nop-server.py origin that never answers
+#
+#     env:  PROXY      proxy executable (default ./proxy)
+#           DIRECT=1   bypass the proxy and load tiny itself (baseline)
+#           DURATION   seconds per scenario (default 10)
+#           CONNS      concurrent connections (default 8)
+#           RATE       open-loop req/s; unset = closed-loop
+#
+
+HOME_DIR=`pwd`
+PROXY=${PROXY:-./proxy}
+DURATION=${DURATION:-10}
+CONNS=${CONNS:-8}
+SCENARIO=${1:-all}
+shift
+EXTRA="$@"
+WORK=`mktemp -d /tmp/bench.XXXXXX`
+
+#
+# wait_for_port - spins until something listens on the port (max 5 s)
+#
+function wait_for_port {
+    for i in `seq 50`; do
+        ss -ltn | grep -q ":$1 " && return 0
+        sleep 0.1
+    done
+    echo "Error: nothing listening on port $1"
+    exit 1
+}
+
+function cleanup {
+    kill ${TINY_PID} ${PROXY_PID} ${NOP_PID} 2> /dev/null
+    rm -rf ${WORK}
+}
+trap cleanup EXIT
+
+if [ ! -x ./loadgen ]; then
+    make -s loadgen > /dev/null || exit 1
+fi
+if [ ! -x ./tiny/tiny ]; then
+    (cd tiny; make -s tiny > /dev/null) || exit 1
+fi
+if [ -z "${DIRECT}" ] && [ ! -x ${PROXY} ]; then
+    echo "Error: ${PROXY} not found. Build the proxy or set PROXY=<path>."
+    exit 1
+fi
+
+# Content served by tiny
+echo "Generating content in ${WORK}"
+for i in `seq 0 19`; do
+    head -c 2048 /dev/urandom > ${WORK}/hot$i.bin
+done
+for i in `seq 0 1999`; do
+    head -c 16384 /dev/urandom > ${WORK}/cold$i.bin
+done
+
+TINY_PORT=`./free-port.sh`
+(cd ${WORK} && exec ${HOME_DIR}/tiny/tiny ${TINY_PORT} > /dev/null 2>&1) &
+TINY_PID=$!
+wait_for_port ${TINY_PORT}
+
+PROXY_OPT=""
+if [ -z "${DIRECT}" ]; then
+    PROXY_PORT=`./free-port.sh`
+    ${PROXY} ${PROXY_PORT} > /dev/null 2>&1 &
+    PROXY_PID=$!
+    wait_for_port ${PROXY_PORT}
+    PROXY_OPT="-x localhost:${PROXY_PORT}"
+fi
+
+LOADGEN="./loadgen -c ${CONNS} -d ${DURATION} ${RATE:+-r ${RATE}} ${PROXY_OPT} ${EXTRA}"
+HOT="-U http://localhost:${TINY_PORT}/hot%d.bin -n 20 -z 1.1"
+COLD="-U http://localhost:${TINY_PORT}/cold%d.bin -n 2000 -z 0"
+
+function run_hit {
+    echo "=== hit: Zipf over 20 x 2 KB objects ==="
+    ${LOADGEN} ${HOT}
+}
+
+function run_miss {
+    echo "=== miss: uniform over 2000 x 16 KB objects ==="
+    ${LOADGEN} ${COLD}
+}
+
+function run_slow {
+    if [ -n "${DIRECT}" ]; then
+        echo "=== slow: skipped (tiny is iterative, a stuck request blocks it entirely) ==="
+        return
+    fi
+    NOP_PORT=`./free-port.sh`
+    ./nop-server.py ${NOP_PORT} > /dev/null 2>&1 &
+    NOP_PID=$!
+    wait_for_port ${NOP_PORT}
+    echo "=== slow: hit scenario with 8 connections stuck on nop-server ==="
+    ./loadgen -c 8 -d ${DURATION} -t ${DURATION} ${PROXY_OPT} \
+        http://localhost:${NOP_PORT}/stuck > /dev/null &
+    STUCK_PID=$!
+    ${LOADGEN} ${HOT}
+    wait ${STUCK_PID}
+    kill ${NOP_PID} 2> /dev/null
+}
+
+case ${SCENARIO} in
+    hit)  run_hit ;;
+    miss) run_miss ;;
+    slow) run_slow ;;
+    all)  run_hit; echo; run_miss; echo; run_slow ;;
+    *)    echo "usage: $0 [hit|miss|slow|all] [loadgen options]"; exit 1 ;;
+esac
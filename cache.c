@@ -1,135 +1,1048 @@
 #include "cache.h"
 #include "csapp.h"
+#include "disktier.h"
+#include "snapshot.h"
+#include "cmem.h"
+#include "cindex.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
+/*
+ * 백그라운드 reclaimer (cache_reclaimer_start)
+ * 빈 공간이 용량의 RECLAIM_LOW_PCT% 아래로 내려가면 깨어나서 RECLAIM_HIGH_PCT%가 될 때까지 쫓아낸다.
+ * lock은 RECLAIM_BATCH개마다 잠깐 놓아서 다른 writer가 오래 기다리지 않도록
+ */
+#define RECLAIM_LOW_PCT 10
+#define RECLAIM_HIGH_PCT 15
+#define RECLAIM_BATCH 32
+#define RECLAIM_IDLE_MSEC 50   /* limbo에 free를 기다리는 노드가 남아 있을 때 다시 볼 간격 */
+
+/* 캐시 용량 BUCKET_BYTES 바이트당 bucket 하나 (작은 객체가 많아도 체인이 짧도록) */
+#define BUCKET_BYTES 512
+#define MIN_BUCKETS 1024
+#define MAX_BUCKETS (1UL << 22)
+
+/* L1 - slot 하나에 direct-mapped 칸 L1_ENTRIES개, L1_MAX_OBJECT보다 큰 객체는 안 넣음 */
+#define L1_ENTRIES 8
+#define L1_MAX_OBJECT 16384
+#define L1_SWEEP_MSEC 100      /* 쉬는 slot의 L1에서 캐시에서 빠진 객체를 놓아 주는 최소 간격 */
+
+/*
+ * purge 규칙 - 메모리 캐시는 바로 지우지만 디스크 2차 캐시는 key index가 없어서 (hash만 있음)
+ * purge를 규칙으로 기억해 두고 디스크에서 메모리로 올릴 때 걸러낸다. PURGE_RULES개가 넘으면 디스크를 통째로 비움
+ * 규칙마다 순번이 있어서 그 purge보다 먼저 메모리에 들어왔던 객체만 거른다. (purge 뒤에 새로 받은 것은 그대로)
+ */
+#define PURGE_RULES 64
+#define SURROGATE_HDR "Surrogate-Key:"
+
 /* ------------ global var ------------ */
-/* 
- * mutex: 한 번에 하나의 스레드만 캐시 정보를 교환할 수 있음
- * w: 변수값 변경도 한 writer만 허용
- * u: 캐시 순회 시에 한 번에 하나의 스레드만 사용하며, LRU노드(제일 최근에 방문한 노드)는 헤드에 위치해야 함
+/*
+ * reader(cache_get)는 lock을 잡지 않는다.
+ * bucket 체인을 atomic load로 따라가고, 공유 메모리에 쓰는 건 처음 hit된 노드의 ref 비트뿐.
+ * writer(cache_place, 통계, 순회)는 c_lock 하나로 순서대로 - 새 노드는 다 채운 뒤에
+ * bucket head에 release store로 걸고, 뺄 때는 앞 노드의 next만 바꾼다. (뺀 노드의 next는 그대로)
+ * 뺀 노드는 읽고 있는 reader가 있을 수 있으니 바로 free하지 않고 epoch이 두 번 지난 뒤에.
  */
-sem_t mutex, w, u; 
-int readcnt;
+static pthread_mutex_t c_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_wake = PTHREAD_COND_INITIALIZER;  /* reclaimer 깨우기 */
+static int c_reclaimer;                                    /* reclaimer가 돌고 있으면 1 */
 static cache_t *g_cache;
 
+enum { PURGE_KEY, PURGE_PREFIX, PURGE_TAG };
+typedef struct {
+    int kind;
+    char *str;
+    unsigned long seq;   /* 이 규칙의 purge 순번 */
+} prule_t;
+static prule_t c_rules[PURGE_RULES];  /* c_lock 안에서만 */
+static int c_nrules;
+static unsigned long c_pseq;          /* 마지막 purge 순번 (c_lock) - 새로 들어오는 객체의 pseq */
+
+static int place_obj(char *key, cobj_t *obj, int promoted, cobj_t *base);
+static void l1_sweep(void);
+
+/* ------------ epoch ------------ */
+/*
+ * 스레드마다 하나씩 있는 epoch 레코드 (다른 스레드와 cache line을 나눠 쓰지 않도록 64바이트 정렬)
+ * reader는 cache_get 동안 (지금 epoch << 1) | 1 을 써 두고, 끝나면 0
+ * 스레드가 끝나면 used를 내려서 다음 스레드가 재사용
+ */
+typedef struct erec {
+    _Alignas(64) atomic_ulong epoch;
+    atomic_int used;
+    atomic_long hits[2];  /* 이 레코드를 쓴 스레드의 hit 수 - [0] 같은 NUMA 노드, [1] 다른 노드 */
+    atomic_long l1_hits;  /* 그중 L1에서 끝난 hit */
+    struct erec *next;
+} erec_t;
+
+static atomic_ulong g_epoch = 1;
+static _Atomic(erec_t *) e_list;
+static _Thread_local erec_t *e_self;
+static pthread_key_t e_key;
+static pthread_once_t e_once = PTHREAD_ONCE_INIT;
+
+static void epoch_release(void *p) {
+  atomic_store(&((erec_t *)p)->used, 0);
+}
+
+static void epoch_key_init(void) {
+  pthread_key_create(&e_key, epoch_release);
+}
+
+/* 이 스레드의 레코드 - 쉬고 있는 것이 있으면 재사용, 없으면 새로 만들어 리스트 앞에 */
+static erec_t *epoch_register(void) {
+  erec_t *r;
+  int zero;
+
+  pthread_once(&e_once, epoch_key_init);
+  for (r = atomic_load(&e_list); r != NULL; r = r->next) {
+    zero = 0;
+    if (atomic_compare_exchange_strong(&r->used, &zero, 1))
+      break;
+  }
+  if (r == NULL) {
+    r = aligned_alloc(64, sizeof(erec_t));
+    atomic_init(&r->epoch, 0);
+    atomic_init(&r->used, 1);
+    atomic_init(&r->hits[0], 0);
+    atomic_init(&r->hits[1], 0);
+    atomic_init(&r->l1_hits, 0);
+    r->next = atomic_load(&e_list);
+    while (!atomic_compare_exchange_weak(&e_list, &r->next, r))
+      ;
+  }
+  pthread_setspecific(e_key, r);
+  e_self = r;
+  return r;
+}
+
+/* reader 구간 시작 - 자기 레코드에만 쓰고, 이후 읽기가 이 store보다 앞서지 않도록 fence */
+static void epoch_enter(void) {
+  erec_t *r = e_self ? e_self : epoch_register();
+  atomic_store_explicit(&r->epoch, (atomic_load_explicit(&g_epoch, memory_order_relaxed) << 1) | 1,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void epoch_exit(void) {
+  atomic_store_explicit(&e_self->epoch, 0, memory_order_release);
+}
+
+/*
+ * (c_lock 안에서) 활동 중인 reader가 모두 지금 epoch에 있으면 epoch을 하나 올리고,
+ * 두 epoch 전에 뺀 노드들을 free
+ */
+static void reclaim(void) {
+  unsigned long g = atomic_load(&g_epoch), e;
+  erec_t *r;
+  cnode_t **pp, *elem, *next;
+
+  for (r = atomic_load(&e_list); r != NULL; r = r->next) {
+    e = atomic_load(&r->epoch);
+    if ((e & 1) && (e >> 1) != g)
+      break;
+  }
+  if (r == NULL)
+    atomic_store(&g_epoch, ++g);
+
+  /* limbo는 최근에 뺀 것이 앞 - retired + 2 <= g 인 첫 노드부터 끝까지 */
+  for (pp = &g_cache->limbo; *pp != NULL && (*pp)->retired + 2 > g; pp = &(*pp)->gc_next)
+    ;
+  elem = *pp;
+  *pp = NULL;
+  for (; elem != NULL; elem = next) {
+    next = elem->gc_next;
+    free(elem->key);
+    cobj_put(elem->obj);
+    free(elem);
+  }
+  l1_sweep();
+}
+
+/* ------------ L1 ------------ */
+/*
+ * L1 칸 하나 - obj 참조 하나를 들고 있음 (캐시에서 빠져도 여기서 놓을 때까지 free 안 됨)
+ * lent : 이 칸에서 빌려 간 채로 아직 cobj_put 안 한 수 (0이 아니면 바꾸지 않음)
+ * hits : 들어온 뒤로 L1 hit 수 - 0인 칸만 다른 객체로 바꿈 (한 번 봐줄 때 0으로)
+ * slot 하나는 한 번에 연결 하나(스레드 하나)만 쓰므로 lock이 필요 없다.
+ * 쉬는 slot은 reclaim이 busy를 잡고 캐시에서 빠진 객체의 칸을 비운다. (l1_sweep)
+ */
+typedef struct {
+    cobj_t *obj;
+    unsigned long hash;
+    unsigned long gen;
+    char *key;
+    int lent;
+    int hits;
+} l1ent_t;
+
+enum { L1_IDLE, L1_BOUND, L1_SWEEPING };
+struct cache_l1 {
+    l1ent_t e[L1_ENTRIES];
+    atomic_int busy;           /* L1_* - 붙은 스레드나 sweep 중인 reclaim만 칸을 건드림 */
+    struct cache_l1 *next;     /* 모든 L1 리스트 (c_lock) */
+};
+
+static _Thread_local cache_l1_t *l1_self;
+static cache_l1_t *c_l1s;          /* cache_l1_new로 만든 L1 전부 (c_lock) */
+static int c_l1_dirty;             /* 마지막 sweep 뒤로 캐시에서 빠진 노드가 있음 (c_lock) */
+static long c_l1_swept;            /* 마지막 sweep 시각 (msec, c_lock) */
 
 /* ------------ routine ------------ */
+/* FNV-1a */
+static unsigned long key_hash(const char *key) {
+  unsigned long h = 0xcbf29ce484222325UL;
+  while (*key)
+    h = (h ^ (unsigned char)*key++) * 0x100000001b3UL;
+  return h;
+}
+
 void cache_init() {
+  cache_init_capacity(MAX_CACHE_SIZE);
+}
+
+/* 용량을 직접 정해서 초기화 (cachesim에서 여러 크기를 돌려볼 때) */
+void cache_init_capacity(size_t capacity) {
+  unsigned long n = MIN_BUCKETS;
+
+  while (n < capacity / BUCKET_BYTES && n < MAX_BUCKETS)
+    n <<= 1;
   g_cache = calloc(1, sizeof(cache_t));
-  Sem_init(&mutex, 0, 1);
-  Sem_init(&w, 0, 1);
-  Sem_init(&u, 0, 1);
-  readcnt = 0;
-}
-
-/* 원하는 캐시(client request) get */
-int cache_get(char *key, char *value) {
-  /* 
-   * 세마포어 발명한 다익스트라가 네덜란드 사람이라서
-   * 변수명 P, V는 아래와 같은 의미!
-   * P : Probeer(try) - 임계영역에 접근 가능하게 해주는 함수
-   * V : Verhoog(increment) - 접근 불가능하게
-   */
-  P(&mutex); /* 임계영역 시작 */
-  if (++readcnt == 1) P(&w);
-  V(&mutex); /* 임계영역 끝 */
+  g_cache->capacity = capacity;
+  g_cache->nbuckets = n;
+  g_cache->buckets = calloc(n, sizeof(*g_cache->buckets));
+}
 
-  
-  int hit;
+/* 헤더 블록 길이 - "\r\n\r\n"까지, HTTP 응답이 아니거나 못 찾으면 0 */
+static size_t header_len(const char *data, size_t size) {
+  const char *p;
+
+  if (size < 5 || memcmp(data, "HTTP/", 5) != 0)
+    return 0;
+  for (p = data; p + 4 <= data + size; p++)
+    if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+      return p + 4 - data;
+  return 0;
+}
+
+/* 헤더 블록에서 Surrogate-Key 값 - 없으면 NULL */
+static const char *surrogate_keys(const char *data, size_t hlen, size_t *len) {
+  const char *p = data, *end = data + hlen, *eol;
+  size_t n = strlen(SURROGATE_HDR);
+
+  for (; p < end; p = eol + 1) {
+    if ((eol = memchr(p, '\n', end - p)) == NULL)
+      break;
+    if ((size_t)(eol - p) > n && strncasecmp(p, SURROGATE_HDR, n) == 0) {
+      for (p += n; p < eol && (*p == ' ' || *p == '\t'); p++)
+        ;
+      for (*len = eol - p; *len > 0 && (p[*len - 1] == '\r' || p[*len - 1] == ' '); (*len)--)
+        ;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/* 공백으로 나뉜 tags에 tag가 있는지 */
+static int has_tag(const char *tags, size_t len, const char *tag) {
+  const char *p = tags, *end = tags + len, *s;
+  size_t n = strlen(tag);
+
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    for (s = p; p < end && *p != ' ' && *p != '\t'; p++)
+      ;
+    if ((size_t)(p - s) == n && memcmp(s, tag, n) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* key (+ 헤더 블록 data)가 purge 규칙 r에 걸리는지 */
+static int rule_match(const prule_t *r, const char *key, size_t key_len, const char *data, size_t size) {
+  size_t n = strlen(r->str), tlen;
+  const char *tags;
+
+  switch (r->kind) {
+  case PURGE_KEY: /* key 자신과 그 variant, segment ("key gzip", "key seg3") */
+    return key_len >= n && memcmp(key, r->str, n) == 0 && (key_len == n || key[n] == CACHE_KEY_SEP);
+  case PURGE_PREFIX:
+    return key_len >= n && memcmp(key, r->str, n) == 0;
+  default:
+    tags = surrogate_keys(data, header_len(data, size), &tlen);
+    return tags != NULL && has_tag(tags, tlen, r->str);
+  }
+}
+
+/* (c_lock 안에서) 디스크에서 올라온 객체가 메모리에 들어온 뒤에 purge된 것인지 */
+static int purged(const char *key, const cobj_t *obj) {
+  int i;
+
+  for (i = 0; i < c_nrules; i++)
+    if (c_rules[i].seq > obj->pseq && rule_match(&c_rules[i], key, strlen(key), obj->data, obj->size))
+      return 1;
+  return 0;
+}
+
+/* 자기 레코드의 카운터 하나 올리기 - 쓰는 스레드가 하나뿐이라 fetch_add 없이 */
+static void count(atomic_long *c) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/* hit 하나 세기 - 객체가 이 스레드의 NUMA 노드에 있으면 local */
+static void count_hit(const cobj_t *obj) {
+  erec_t *r = e_self ? e_self : epoch_register();
+  count(&r->hits[obj->node != cmem_self_node()]);
+}
+
+static void obj_unref(cobj_t *obj) {
+  if (atomic_fetch_sub_explicit(&obj->refs, 1, memory_order_acq_rel) == 1)
+    cmem_free(obj);
+}
+
+/* 공유 참조 하나 더 - L1과 상관없이 다른 스레드가 cobj_put으로 놓을 수 있음 (zerocopy 전송이 안 끝난 객체) */
+void cobj_get(cobj_t *obj) {
+  atomic_fetch_add_explicit(&obj->refs, 1, memory_order_relaxed);
+}
+
+/* 참조 하나 반납 - L1에서 빌려 간 것이면 lent만, 아니면 공유 refs를 내리고 마지막이면 free */
+void cobj_put(cobj_t *obj) {
+  int i;
+
+  if (l1_self != NULL)
+    for (i = 0; i < L1_ENTRIES; i++)
+      if (l1_self->e[i].obj == obj && l1_self->e[i].lent > 0) {
+        l1_self->e[i].lent--;
+        return;
+      }
+  obj_unref(obj);
+}
+
+/* TTL이 지난 음성 캐시 객체 - hit로 치지 않음 (같은 key로 새로 들어오면 그때 바뀜) */
+static int expired(const cobj_t *obj) {
+  return obj->expires != 0 && time(NULL) >= obj->expires;
+}
+
+static int l1_valid(const l1ent_t *e) {
+  return atomic_load_explicit(&e->obj->gen, memory_order_acquire) == e->gen;
+}
+
+/* 칸 비우기 - L1 몫 참조를 놓음 */
+static void l1_drop(l1ent_t *e) {
+  obj_unref(e->obj);
+  free(e->key);
+  e->obj = NULL;
+}
+
+cache_l1_t *cache_l1_new(void) {
+  cache_l1_t *l1 = (cache_l1_t *)calloc(1, sizeof(cache_l1_t));
+
+  if (l1 == NULL)
+    return NULL;
+  atomic_init(&l1->busy, L1_IDLE);
+  pthread_mutex_lock(&c_lock);
+  l1->next = c_l1s;
+  c_l1s = l1;
+  pthread_mutex_unlock(&c_lock);
+  return l1;
+}
+
+/* l1에서 캐시에서 빠진 객체의 칸을 비움 (빌려 간 칸은 그대로) */
+static void l1_prune(cache_l1_t *l1) {
+  int i;
+
+  for (i = 0; i < L1_ENTRIES; i++)
+    if (l1->e[i].obj != NULL && l1->e[i].lent == 0 && !l1_valid(&l1->e[i]))
+      l1_drop(&l1->e[i]);
+}
+
+/*
+ * 지금 스레드가 l1을 쓰도록 (연결을 맡을 때 그 slot의 L1, 끝나면 NULL)
+ * 놓을 때 캐시에서 빠진 객체의 칸은 비워서 쉬는 slot이 메모리를 잡고 있지 않도록
+ * 쉬는 동안 빠진 것은 reclaim의 l1_sweep이 비움 - 그 sweep이 끝날 때까지만 기다림
+ */
+void cache_l1_bind(cache_l1_t *l1) {
+  int idle;
+
+  if (l1 == NULL && l1_self != NULL) {
+    l1_prune(l1_self);
+    atomic_store_explicit(&l1_self->busy, L1_IDLE, memory_order_release);
+  }
+  if (l1 != NULL)
+    do
+      idle = L1_IDLE;
+    while (!atomic_compare_exchange_weak_explicit(&l1->busy, &idle, L1_BOUND,
+                                                  memory_order_acquire, memory_order_relaxed));
+  l1_self = l1;
+}
+
+/*
+ * (c_lock 안에서) 쉬는 slot의 L1마다 캐시에서 빠진 객체를 놓음 - 안 그러면 그 slot이 다시 쓰일 때까지
+ * 용량 밖에서 메모리를 잡고 있게 된다. 노드가 빠졌을 때만, L1_SWEEP_MSEC에 한 번까지
+ */
+static void l1_sweep(void) {
+  cache_l1_t *l1;
+  struct timespec ts;
+  long now;
+  int idle;
+
+  if (!c_l1_dirty)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+  if (now - c_l1_swept < L1_SWEEP_MSEC)
+    return;
+  c_l1_swept = now;
+  c_l1_dirty = 0;
+  for (l1 = c_l1s; l1 != NULL; l1 = l1->next) {
+    idle = L1_IDLE;
+    /* 붙어 있는 L1은 주인이 놓을 때 스스로 비움 */
+    if (!atomic_compare_exchange_strong_explicit(&l1->busy, &idle, L1_SWEEPING,
+                                                 memory_order_acquire, memory_order_relaxed))
+      continue;
+    l1_prune(l1);
+    atomic_store_explicit(&l1->busy, L1_IDLE, memory_order_release);
+  }
+}
+
+/* L1에서 key 찾기 - 있으면 빌려 줌 (공유 메모리에는 쓰지 않음, CLOCK 비트만 꺼져 있을 때) */
+static cobj_t *l1_get(const char *key, unsigned long h) {
+  l1ent_t *e = &l1_self->e[h & (L1_ENTRIES - 1)];
+  erec_t *r;
+
+  if (e->obj == NULL || e->hash != h || strcmp(e->key, key) != 0)
+    return NULL;
+  if (!l1_valid(e) || expired(e->obj)) {
+    if (e->lent == 0)
+      l1_drop(e);
+    return NULL;
+  }
+  /* 공유 캐시 쪽 CLOCK도 이 객체가 hot한 걸 알아야 쫓아내지 않음 */
+  if (!atomic_load_explicit(&e->obj->ref, memory_order_relaxed))
+    atomic_store_explicit(&e->obj->ref, 1, memory_order_relaxed);
+  e->lent++;
+  e->hits++;
+  count_hit(e->obj);
+  r = e_self;
+  count(&r->l1_hits);
+  return e->obj;
+}
+
+/* 공유 캐시에서 hit된 obj를 L1에 (칸이 비었거나, 무효거나, 들어온 뒤로 hit가 없었으면) */
+static void l1_put(const char *key, unsigned long h, cobj_t *obj, unsigned long gen) {
+  l1ent_t *e = &l1_self->e[h & (L1_ENTRIES - 1)];
+
+  if (obj->size > L1_MAX_OBJECT || gen == 0)
+    return;
+  if (e->obj != NULL) {
+    if (e->lent > 0)
+      return;
+    if (l1_valid(e) && e->hits > 0) {
+      e->hits = 0; /* 한 번 봐줌 */
+      return;
+    }
+    l1_drop(e);
+  }
+  atomic_fetch_add_explicit(&obj->refs, 1, memory_order_relaxed);
+  e->obj = obj;
+  e->hash = h;
+  e->gen = gen;
+  e->key = strdup(key);
+  e->lent = 0;
+  e->hits = 0;
+}
+
+/*
+ * 이 스레드의 NUMA 노드에 size 바이트짜리 객체를 만들어 value를 복사
+ * hlen, stored를 채우고 refs는 캐시 몫 하나 + 호출한 쪽이 가져갈 만큼 - 메모리가 없으면 NULL
+ */
+static cobj_t *cobj_new(const char *value, size_t size, long refs) {
+  cobj_t *obj;
+
+  if ((obj = (cobj_t *)cmem_alloc(sizeof(cobj_t) + size)) == NULL)
+    return NULL;
+  memcpy(obj->data, value, size);
+  obj->size = size;
+  obj->hlen = header_len(obj->data, obj->size);
+  obj->stored = time(NULL);
+  obj->expires = 0;
+  obj->node = cmem_node(obj);
+  atomic_init(&obj->refs, refs);
+  atomic_init(&obj->ref, 0);
+  atomic_init(&obj->gen, 0);
+  atomic_init(&obj->no_enc, 0);
+  obj->pseq = 0;
+  return obj;
+}
+
+/* 원하는 캐시(client request) get - hit이면 value에 복사한 바이트 수, miss면 0 리턴 */
+size_t cache_get(char *key, char *value) {
+  size_t hit;
   cnode_t *elem;
+  unsigned long h = key_hash(key), pseq = 0;
+
   hit = 0;
-  elem = g_cache->head;
+  epoch_enter();
+  elem = atomic_load_explicit(&g_cache->buckets[h & (g_cache->nbuckets - 1)], memory_order_acquire);
   while (elem != NULL) {
-    /* 현재 노드의 key값이 찾고자하는 client request content와 같지 않으면 */
-    if (!strcmp(elem->key, key)) { /* strcmp : returns 0 if same // not 0 = True */
-      /* 현재 노드가 헤드노드가 아니면 가장 최근에 참조했으니 head로 옮긴다. */
-      if (elem != g_cache->head) { 
-        P(&u); /* 임계영역 시작 */
-        /* 현재의 다음으로 next 이어줌 */
-        elem->prev->next = elem->next;
-        if (elem == g_cache->tail)
-          g_cache->tail = elem->prev;
-        else
-          elem->next->prev = elem->prev;
-        /* 현재 노드를 head로 재조정 */
-        elem->prev = NULL;
-        elem->next = g_cache->head;
-        if (g_cache->head != NULL) g_cache->head->prev = elem;
-        g_cache->head = elem;
-        V(&u); /* 임계영역 끝 */
-      }
-      /* 현재 노드가 헤드노드면 바로 뽑아내면 된다. LRU! */
-      strcpy(value, elem->value);
-      hit = 1;
+    if (elem->hash == h && !strcmp(elem->key, key)) {
+      if (expired(elem->obj))
+        break;
+      /* 최근에 참조했다는 표시 - 이미 1이면 쓰지 않아서 cache line을 더럽히지 않음 */
+      if (!atomic_load_explicit(&elem->obj->ref, memory_order_relaxed))
+        atomic_store_explicit(&elem->obj->ref, 1, memory_order_relaxed);
+      memcpy(value, elem->obj->data, elem->obj->size);
+      hit = elem->obj->size;
+      count_hit(elem->obj);
       break;
     }
-    /* 현재 노드의 key값이 찾고자하는 client request content와 같으면 다음 노드로 옮겨서 확인 */
-    elem = elem->next;
+    elem = atomic_load_explicit(&elem->next, memory_order_acquire);
   }
+  epoch_exit();
 
-  P(&mutex); /* 임계영역 시작 */
-  if (--readcnt == 0) V(&w); 
-  V(&mutex); /* 임계영역 끝 */
-
+  /*
+   * 메모리 miss면 지난번 스냅샷 -> 디스크 2차 캐시 순으로 확인, 있으면 메모리로 다시 올림
+   * (만료된 음성 캐시라서 miss인 경우는 제외 - elem != NULL)
+   * 스냅샷 항목은 이번 실행의 어떤 purge보다도 먼저라서 pseq 0
+   */
+  if (hit == 0 && elem == NULL && snap_enabled())
+    hit = snap_get(key, value, MAX_OBJECT_SIZE);
+  if (hit == 0 && elem == NULL && disk_enabled())
+    hit = disk_get(key, value, MAX_OBJECT_SIZE, &pseq);
+  if (hit > 0 && elem == NULL) {
+    cobj_t *obj = cobj_new(value, hit, 1);
+    if (obj != NULL)
+      obj->pseq = pseq;
+    if (obj != NULL && place_obj(key, obj, 1, NULL) < 0)
+      hit = 0; /* 디스크에 남아 있던 purge된 객체 */
+  }
 
-  /* 
+  /*
    * hit = 0 -> 캐시에 저장된 request가 없으므로 엔드 서버에 요청해야함
    * hit > 0 -> 캐시에 저장된 request가 있으므로 프록시 서버에서 바로 응답
    */
   return hit;
 }
 
-/* 캐시 저장 */
-void cache_place(char *key, char *value) {
-  P(&w); /* 임계영역 시작 */
+/*
+ * 복사 없이 캐시 객체를 빌려 옴 - hit이면 참조를 하나 올려서 리턴 (다 쓰면 cobj_put), miss면 NULL
+ * 쫓겨나도 참조가 남아 있는 동안은 free되지 않으므로 느린 클라이언트에게 보내는 동안 잡고 있어도 됨
+ */
+cobj_t *cache_acquire(char *key) {
+  cobj_t *obj = NULL;
   cnode_t *elem;
-  size_t size = strlen(key) + strlen(value) + sizeof(elem);
-  g_cache->size += size;
-  while ((g_cache->tail != NULL) && (g_cache->size > MAX_CACHE_SIZE)) {
-    /* 캐시를 저장할 충분한 공간이 없으면 tail 부터 삭제함 (LRU) */
-    elem = g_cache->tail;
-    size = strlen(elem->key) + strlen(elem->value) + sizeof(elem);
-
-    g_cache->size -= size;
-    g_cache->tail = g_cache->tail->prev;
-    g_cache->tail->next = NULL;
-    free(elem->key);
-    free(elem->value);
-    free(elem);
+  size_t size;
+  char *buf;
+  unsigned long h = key_hash(key), gen = 0, pseq = 0;
+
+  if (l1_self != NULL && (obj = l1_get(key, h)) != NULL)
+    return obj;
+
+  epoch_enter();
+  elem = atomic_load_explicit(&g_cache->buckets[h & (g_cache->nbuckets - 1)], memory_order_acquire);
+  while (elem != NULL) {
+    if (elem->hash == h && !strcmp(elem->key, key)) {
+      if (expired(elem->obj))
+        break;
+      if (!atomic_load_explicit(&elem->obj->ref, memory_order_relaxed))
+        atomic_store_explicit(&elem->obj->ref, 1, memory_order_relaxed);
+      /* 캐시 몫 참조는 epoch이 두 번 지나야 내려가므로 여기서는 0이 아님 */
+      obj = elem->obj;
+      atomic_fetch_add_explicit(&obj->refs, 1, memory_order_relaxed);
+      gen = atomic_load_explicit(&obj->gen, memory_order_relaxed);
+      count_hit(obj);
+      break;
+    }
+    elem = atomic_load_explicit(&elem->next, memory_order_acquire);
+  }
+  epoch_exit();
+  if (obj != NULL && l1_self != NULL)
+    l1_put(key, h, obj, gen);
+  /* 만료된 음성 캐시는 아래 tier에도 없으므로 (내려보내지 않음) 바로 miss */
+  if (obj != NULL || elem != NULL || (!snap_enabled() && !disk_enabled()))
+    return obj;
+
+  /* 스냅샷, 디스크에 있으면 새 객체로 읽어서 메모리에 올리고 같이 씀 */
+  if ((buf = (char *)malloc(MAX_OBJECT_SIZE)) == NULL)
+    return NULL; /* 읽을 버퍼가 없으면 miss로 */
+  size = 0;
+  if (snap_enabled())
+    size = snap_get(key, buf, MAX_OBJECT_SIZE);
+  if (size == 0 && disk_enabled())
+    size = disk_get(key, buf, MAX_OBJECT_SIZE, &pseq);
+  obj = size > 0 ? cobj_new(buf, size, 2) : NULL;
+  free(buf);
+  if (obj != NULL)
+    obj->pseq = pseq;
+  if (obj != NULL && place_obj(key, obj, 1, NULL) < 0) {
+    obj_unref(obj);
+    obj = NULL;
+  }
+  return obj;
+}
+
+/* (c_lock 안에서) elem을 bucket 체인과 CLOCK 원형 리스트에서 뺌 - elem->next는 건드리지 않음 */
+static void unlink_node(cnode_t *elem) {
+  _Atomic(cnode_t *) *pp = &g_cache->buckets[elem->hash & (g_cache->nbuckets - 1)];
+  cnode_t *cur;
+
+  while ((cur = atomic_load_explicit(pp, memory_order_relaxed)) != elem)
+    pp = &cur->next;
+  atomic_store_explicit(pp, atomic_load_explicit(&elem->next, memory_order_relaxed), memory_order_release);
+
+  if (elem->cnext == elem)
+    g_cache->hand = NULL;
+  else {
+    elem->cprev->cnext = elem->cnext;
+    elem->cnext->cprev = elem->cprev;
+    if (g_cache->hand == elem)
+      g_cache->hand = elem->cnext;
   }
+  cindex_remove(elem);
+  g_cache->size -= strlen(elem->key) + elem->obj->size + sizeof(elem);
+  atomic_store_explicit(&elem->obj->gen, 0, memory_order_release); /* L1에 있는 참조도 무효 */
+  c_l1_dirty = 1;
+  g_cache->entries--;
+}
+
+/* (c_lock 안에서) 뺀 노드를 limbo에 - reader가 다 지나간 뒤 reclaim에서 free */
+static void retire(cnode_t *elem) {
+  elem->retired = atomic_load(&g_epoch);
+  elem->gc_next = g_cache->limbo;
+  g_cache->limbo = elem;
+}
+
+/* (c_lock 안에서) hand부터 ref가 1이면 한 번 봐주고 지나가며 (CLOCK) 하나를 쫓아냄 */
+static cnode_t *evict_one(void) {
+  cnode_t *elem;
+
+  while (atomic_load_explicit(&g_cache->hand->obj->ref, memory_order_relaxed)) {
+    atomic_store_explicit(&g_cache->hand->obj->ref, 0, memory_order_relaxed);
+    g_cache->hand = g_cache->hand->cnext;
+  }
+  elem = g_cache->hand;
+  unlink_node(elem);
+  g_cache->evictions++;
+  return elem;
+}
+
+/* (c_lock 안에서) 남은 공간 */
+static size_t free_bytes(void) {
+  return g_cache->size < g_cache->capacity ? g_cache->capacity - g_cache->size : 0;
+}
+
+/* 캐시 저장 */
+void cache_place(char *key, char *value, size_t value_size) {
+  cache_place_ttl(key, value, value_size, 0);
+}
+
+/*
+ * ttl초 뒤에 만료되는 캐시 저장 (0이면 만료 없음) - 404 같은 음성 응답, DNS 실패 (size 0짜리 작은 객체)
+ * 만료되는 객체는 쫓겨나도 디스크로 내려보내지 않고 스냅샷에도 넣지 않는다. (거기서는 만료 시각을 모름)
+ */
+void cache_place_ttl(char *key, char *value, size_t value_size, int ttl) {
+  cobj_t *obj = cobj_new(value, value_size, 1);
 
-  /* 캐시를 저장할 공간이 충분하면 head로 새롭게 넣는다. */
+  if (obj == NULL)
+    return;
+  if (ttl > 0)
+    obj->expires = obj->stored + ttl;
+  place_obj(key, obj, 0, NULL);
+}
+
+/*
+ * base에서 만든 객체 (압축 variant) 저장 - base가 아직 캐시에 있을 때만
+ * 만드는 동안 base가 purge되거나 (같은 key의 새 응답으로) 바뀌었으면 옛 내용으로 만든 것을 다시 넣지 않음
+ * 리턴값 : 넣었으면 0, 버렸으면 -1
+ */
+int cache_place_derived(char *key, char *value, size_t value_size, cobj_t *base) {
+  cobj_t *obj = cobj_new(value, value_size, 1);
+
+  if (obj == NULL)
+    return -1;
+  return place_obj(key, obj, 0, base);
+}
+
+/*
+ * 캐시 저장 - 다 채운 obj의 캐시 몫 참조를 넘겨받음
+ * promoted : 스냅샷, 디스크에서 다시 올리는 것 - obj->pseq 뒤의 purge 규칙에 걸리면 넣지 않고 (캐시 몫 참조를 놓고) -1
+ * base     : NULL이 아니면 이 객체가 캐시에서 빠졌을 때 (세대 번호 0) 넣지 않고 -1
+ */
+static int place_obj(char *key, cobj_t *obj, int promoted, cobj_t *base) {
+  cnode_t *elem, *victims = NULL, *cur;
+  size_t size = strlen(key) + obj->size + sizeof(elem), tlen = 0;
+  unsigned long h = key_hash(key);
+  const char *tags = surrogate_keys(obj->data, obj->hlen, &tlen);
+
+  /* 노드는 lock 밖에서 다 채워 둔다 */
   elem = (cnode_t *)malloc(sizeof(cnode_t));
   elem->key = (char *)malloc(strlen(key) + 1);
-  elem->value = (char *)malloc(strlen(value) + 1);
   strcpy(elem->key, key);
-  strcpy(elem->value, value);
+  elem->obj = obj;
+  elem->hash = h;
+
+  pthread_mutex_lock(&c_lock); /* 임계영역 시작 */
+
+  if ((promoted && purged(key, obj)) || (base != NULL && atomic_load_explicit(&base->gen, memory_order_relaxed) == 0)) {
+    pthread_mutex_unlock(&c_lock);
+    free(elem->key);
+    free(elem);
+    obj_unref(obj);
+    return -1;
+  }
+
+  /* 같은 key가 이미 있으면 (같은 객체를 동시에 miss) 옛 것을 뺌 */
+  for (cur = atomic_load_explicit(&g_cache->buckets[h & (g_cache->nbuckets - 1)], memory_order_relaxed);
+       cur != NULL; cur = atomic_load_explicit(&cur->next, memory_order_relaxed))
+    if (cur->hash == h && !strcmp(cur->key, key)) {
+      unlink_node(cur);
+      retire(cur);
+      break;
+    }
+
+  /*
+   * 캐시를 저장할 충분한 공간이 없으면 여기서 바로 쫓아냄
+   * reclaimer가 돌고 있으면 보통은 미리 비워 둔 공간이 있어서 이 loop를 안 탄다.
+   */
+  g_cache->size += size;
+  while ((g_cache->hand != NULL) && (g_cache->size > g_cache->capacity)) {
+    cur = evict_one();
+    g_cache->sync_evictions++;
+    /* 쫓아낸 노드는 모아뒀다가 lock을 푼 뒤에 디스크로 */
+    cur->gc_next = victims;
+    victims = cur;
+  }
 
-  elem->prev = NULL;
-  elem->next = g_cache->head;
-  if (g_cache->head == NULL)
-    g_cache->tail = elem;
-  else
-    g_cache->head->prev = elem;
-  g_cache->head = elem;
+  /* 새 노드는 hand 바로 앞 (hand가 가장 늦게 도착하는 자리) */
+  if (g_cache->hand == NULL) {
+    elem->cprev = elem->cnext = elem;
+    g_cache->hand = elem;
+  }
+  else {
+    elem->cnext = g_cache->hand;
+    elem->cprev = g_cache->hand->cprev;
+    elem->cprev->cnext = elem;
+    g_cache->hand->cprev = elem;
+  }
+  atomic_store_explicit(&obj->gen, ++g_cache->gen, memory_order_relaxed);
+  if (!promoted)
+    obj->pseq = c_pseq;
+  /* bucket head에 publish - 노드 내용이 다 보인 뒤에 포인터가 보이도록 release */
+  atomic_store_explicit(&elem->next,
+                        atomic_load_explicit(&g_cache->buckets[h & (g_cache->nbuckets - 1)], memory_order_relaxed),
+                        memory_order_relaxed);
+  atomic_store_explicit(&g_cache->buckets[h & (g_cache->nbuckets - 1)], elem, memory_order_release);
+  g_cache->entries++;
+  cindex_add(elem, tags, tlen);
 
-  V(&w); /* 임계영역 끝 */
+  if (!disk_enabled()) {
+    while ((cur = victims) != NULL) {
+      victims = cur->gc_next;
+      retire(cur);
+    }
+  }
+  /* free는 reclaimer가 모아서 - 없으면 여기서 */
+  if (!c_reclaimer)
+    reclaim();
+  else if (free_bytes() < g_cache->capacity / 100 * RECLAIM_LOW_PCT || g_cache->limbo != NULL)
+    pthread_cond_signal(&c_wake);
+  pthread_mutex_unlock(&c_lock); /* 임계영역 끝 */
+
+  if (victims == NULL)
+    return 0;
+  /* 디스크로 내려보낸 뒤에 limbo로 - 아직 limbo에 없으니 다른 writer가 free할 수 없음 */
+  for (cur = victims; cur != NULL; cur = cur->gc_next)
+    if (cur->obj->expires == 0)
+      disk_put(cur->key, cur->obj->data, cur->obj->size, cur->obj->pseq);
+  pthread_mutex_lock(&c_lock);
+  while ((cur = victims) != NULL) {
+    victims = cur->gc_next;
+    retire(cur);
+  }
+  if (c_reclaimer)
+    pthread_cond_signal(&c_wake);
+  pthread_mutex_unlock(&c_lock);
+  return 0;
 }
 
-/* 캐시 전체 노드에 할당했던 메모리를 전부 free */
+/*
+ * reclaimer 스레드 - 빈 공간이 low watermark 아래로 내려가면 high watermark까지 쫓아내고,
+ * 쫓아낸 노드의 free도 여기서 모아서 (reader가 다 지나간 것부터) 한다.
+ * 요청 처리 스레드는 보통 insert만 하고 바로 돌아감
+ */
+static void *cache_reclaimer(void *vargp) {
+  cnode_t *victims, *cur;
+  struct timespec ts;
+  size_t low, high;
+  int n, draining = 0;
+
+  pthread_detach(pthread_self());
+  pthread_mutex_lock(&c_lock);
+  while (1) {
+    low = g_cache->capacity / 100 * RECLAIM_LOW_PCT;
+    high = g_cache->capacity / 100 * RECLAIM_HIGH_PCT;
+    if (!draining && free_bytes() >= low) {
+      if (g_cache->limbo == NULL && !c_l1_dirty)
+        pthread_cond_wait(&c_wake, &c_lock);
+      else {
+        /* 쫓아낼 건 없고 free (, L1 sweep)만 남음 - reader가 지나가서 epoch이 넘어가길 기다림 */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += RECLAIM_IDLE_MSEC * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+          ts.tv_sec++;
+          ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&c_wake, &c_lock, &ts);
+      }
+    }
+    if (free_bytes() < low)
+      draining = 1;
+
+    victims = NULL;
+    for (n = 0; draining && n < RECLAIM_BATCH && g_cache->hand != NULL && free_bytes() < high; n++) {
+      cur = evict_one();
+      cur->gc_next = victims;
+      victims = cur;
+    }
+    if (free_bytes() >= high || g_cache->hand == NULL)
+      draining = 0;
+
+    if (victims != NULL && disk_enabled()) {
+      /* 디스크 쓰기는 lock 밖에서 - 아직 limbo에 없으니 free될 일 없음 */
+      pthread_mutex_unlock(&c_lock);
+      for (cur = victims; cur != NULL; cur = cur->gc_next)
+        if (cur->obj->expires == 0)
+          disk_put(cur->key, cur->obj->data, cur->obj->size, cur->obj->pseq);
+      pthread_mutex_lock(&c_lock);
+    }
+    while ((cur = victims) != NULL) {
+      victims = cur->gc_next;
+      retire(cur);
+    }
+    reclaim();
+
+    /* batch 사이에 lock을 잠깐 놓아서 기다리던 writer가 들어오도록 */
+    pthread_mutex_unlock(&c_lock);
+    pthread_mutex_lock(&c_lock);
+  }
+  return NULL;
+}
+
+/* 백그라운드 reclaimer 시작 - 안 부르면 (cachesim 등) cache_place가 직접 쫓아내고 free */
+int cache_reclaimer_start(void) {
+  pthread_t tid;
+
+  if (pthread_create(&tid, NULL, cache_reclaimer, NULL) != 0)
+    return -1;
+  pthread_mutex_lock(&c_lock);
+  c_reclaimer = 1;
+  pthread_mutex_unlock(&c_lock);
+  return 0;
+}
+
+/* 통계용 - writer lock을 잠깐 잡고 크기, 노드 수, 누적 eviction 수를 복사 */
+void cache_stats(cache_stats_t *st) {
+  erec_t *r;
+
+  st->hits_local = st->hits_remote = st->hits_l1 = 0;
+  for (r = atomic_load(&e_list); r != NULL; r = r->next) {
+    st->hits_local += atomic_load_explicit(&r->hits[0], memory_order_relaxed);
+    st->hits_remote += atomic_load_explicit(&r->hits[1], memory_order_relaxed);
+    st->hits_l1 += atomic_load_explicit(&r->l1_hits, memory_order_relaxed);
+  }
+  pthread_mutex_lock(&c_lock);
+  st->size = g_cache->size;
+  st->entries = g_cache->entries;
+  st->evictions = g_cache->evictions;
+  st->sync_evictions = g_cache->sync_evictions;
+  st->purged = g_cache->purged;
+  st->capacity = g_cache->capacity;
+  pthread_mutex_unlock(&c_lock);
+}
+
+/* 모든 노드를 오래된 것(hand)부터 fn에 넘김 - 스냅샷용. writer lock 안이므로 fn은 복사만 (만료되는 객체는 빼고) */
+void cache_walk(void (*fn)(const char *key, const char *value, size_t size, void *arg), void *arg) {
+  cnode_t *elem;
+  pthread_mutex_lock(&c_lock);
+  if ((elem = g_cache->hand) != NULL) {
+    do {
+      if (elem->obj->expires == 0)
+        fn(elem->key, elem->obj->data, elem->obj->size, arg);
+      elem = elem->cnext;
+    } while (elem != g_cache->hand);
+  }
+  pthread_mutex_unlock(&c_lock);
+}
+
+/* snap_purge에 넘기는 규칙 검사 */
+static int snap_rule(const char *key, size_t key_len, const char *value, size_t size, void *arg) {
+  return rule_match((const prule_t *)arg, key, key_len, value, size);
+}
+
+/* (c_lock 안에서) key와 "key " (key + CACHE_KEY_SEP)로 시작하는 variant, meta, segment 노드들 (gc_next 리스트) */
+static cnode_t *key_family(const char *key) {
+  cnode_t *list, *cur;
+  char *family;
+  unsigned long h = key_hash(key);
+
+  family = (char *)malloc(strlen(key) + 2);
+  sprintf(family, "%s%c", key, CACHE_KEY_SEP);
+  list = cindex_prefix(family);
+  free(family);
+  for (cur = atomic_load_explicit(&g_cache->buckets[h & (g_cache->nbuckets - 1)], memory_order_relaxed);
+       cur != NULL; cur = atomic_load_explicit(&cur->next, memory_order_relaxed))
+    if (cur->hash == h && !strcmp(cur->key, key)) {
+      cur->gc_next = list;
+      list = cur;
+      break;
+    }
+  return list;
+}
+
+/* (c_lock 안에서) list의 노드를 다 빼서 limbo로 - 뺀 수 리턴 */
+static long purge_nodes(cnode_t *list) {
+  cnode_t *next;
+  long n = 0;
+
+  for (; list != NULL; list = next) {
+    next = list->gc_next; /* retire가 gc_next를 덮어씀 */
+    unlink_node(list);
+    retire(list);
+    n++;
+  }
+  return n;
+}
+
+/*
+ * (c_lock 안에서) 디스크, 스냅샷용 purge 규칙 하나 추가 - seq는 이번 purge의 순번
+ * 규칙이 너무 많으면 걸러내는 비용이 커지므로 디스크를 통째로 비우고 처음부터
+ */
+static void add_rule(int kind, const char *str, unsigned long seq) {
+  int i;
+
+  if (c_nrules == PURGE_RULES) {
+    disk_clear();
+    for (i = 0; i < c_nrules; i++)
+      free(c_rules[i].str);
+    c_nrules = 0;
+  }
+  c_rules[c_nrules].kind = kind;
+  c_rules[c_nrules].seq = seq;
+  c_rules[c_nrules++].str = strdup(str);
+}
+
+/*
+ * tag가 붙은 key의 family 뿌리 (malloc) - 큰 객체는 헤더가 "key meta"에 있으므로
+ * 그 meta 접미사를 떼어야 key_family가 segment ("key seg<i>")까지 찾는다.
+ */
+static char *family_root(const char *key) {
+  size_t len = strlen(key), n = strlen(CACHE_META_SUFFIX);
+  char *root = strdup(key);
+
+  if (root != NULL && len > n + 1 && root[len - n - 1] == CACHE_KEY_SEP && strcmp(root + len - n, CACHE_META_SUFFIX) == 0)
+    root[len - n - 1] = '\0';
+  return root;
+}
+
+/*
+ * purge - kind에 따라 str인 key (+ 그 variant, segment), str로 시작하는 key, str tag를 단 key를 지움
+ * 메모리 : index (cindex)로 찾은 노드만 빼서 limbo로 (디스크로 내려보내지 않음)
+ *          세대 번호가 0이 되므로 slot L1에 남은 참조도 다음 hit에서 무효
+ * 스냅샷 : 아직 메모리로 안 올라간 항목을 버림 표시
+ * 디스크 : 순번을 붙인 규칙으로 기억했다가 place_obj에서 그보다 먼저 메모리에 들어왔던 것만 거름
+ * 리턴값 : 지운 객체 수
+ */
+static long purge(int kind, const char *str) {
+  prule_t rule = {kind, (char *)str, 0}, krule = {PURGE_KEY, NULL, 0};
+  cnode_t *cur;
+  char **keys = NULL;
+  long n = 0, nkeys = 0, i;
+  unsigned long seq;
+
+  pthread_mutex_lock(&c_lock);
+  if (kind == PURGE_KEY)
+    n = purge_nodes(key_family(str));
+  else if (kind == PURGE_PREFIX)
+    n = purge_nodes(cindex_prefix(str));
+  else {
+    /*
+     * tag는 헤더가 있는 노드에만 붙어 있으므로 (segment에는 없음) 찾은 key마다 family 전체를 지움
+     * 찾은 노드 중에 다른 노드의 family가 있을 수 있어서 key를 먼저 복사해 두고 하나씩 다시 찾음
+     */
+    for (cur = cindex_tag(str); cur != NULL; cur = cur->gc_next)
+      nkeys++;
+    keys = (char **)malloc((nkeys + 1) * sizeof(char *));
+    for (i = 0, cur = cindex_tag(str); cur != NULL; cur = cur->gc_next)
+      keys[i++] = family_root(cur->key);
+    for (i = 0; i < nkeys; i++)
+      n += purge_nodes(key_family(keys[i]));
+  }
+  g_cache->purged += n;
+
+  /*
+   * 디스크, 스냅샷에는 tag 규칙 말고도 찾은 key마다 key 규칙을 남김
+   * segment는 헤더가 없어서 tag 규칙에 걸리지 않으므로 family 전체를 key로 거름
+   */
+  if (disk_enabled() || snap_enabled()) {
+    seq = ++c_pseq;
+    add_rule(kind, str, seq);
+    for (i = 0; i < nkeys; i++)
+      add_rule(PURGE_KEY, keys[i], seq);
+  }
+  if (!c_reclaimer)
+    reclaim();
+  else if (g_cache->limbo != NULL)
+    pthread_cond_signal(&c_wake);
+  pthread_mutex_unlock(&c_lock);
+
+  if (snap_enabled()) {
+    n += snap_purge(snap_rule, &rule);
+    for (i = 0; i < nkeys; i++) {
+      krule.str = keys[i];
+      n += snap_purge(snap_rule, &krule);
+    }
+  }
+  for (i = 0; i < nkeys; i++)
+    free(keys[i]);
+  free(keys);
+  return n;
+}
+
+/* key와 그 variant (gzip, br), 큰 객체의 meta, segment (seg<i>) */
+long cache_purge(const char *key) {
+  return purge(PURGE_KEY, key);
+}
+
+/* key가 prefix로 시작하는 것 전부 ("GET http://host:port/static/") */
+long cache_purge_prefix(const char *prefix) {
+  return purge(PURGE_PREFIX, prefix);
+}
+
+/* 응답의 Surrogate-Key 헤더에 tag가 있는 것 전부 */
+long cache_purge_tag(const char *tag) {
+  return purge(PURGE_TAG, tag);
+}
+
+/* 캐시 전체 노드에 할당했던 메모리를 전부 free (다른 스레드가 캐시를 안 쓸 때) */
 void cache_destroy() {
   cnode_t *elem, *tmp;
   if (g_cache != NULL) {
-    elem = g_cache->head;
-    while (elem != NULL) {
-      tmp = elem->next;
+    while ((elem = g_cache->hand) != NULL) {
+      unlink_node(elem);
+      retire(elem);
+    }
+    for (elem = g_cache->limbo; elem != NULL; elem = tmp) {
+      tmp = elem->gc_next;
       free(elem->key);
-      free(elem->value);
+      cobj_put(elem->obj);
       free(elem);
-      elem = tmp;
     }
+    free(g_cache->buckets);
+    free(g_cache);
+    g_cache = NULL;
   }
-}
\ No newline at end of file
+}
@@ -1,32 +1,109 @@
 #ifndef __CACHE_H__
 #define __CACHE_H__
 
+#include <stdatomic.h>
 #include "csapp.h"
 
-/* 
+/*
+ * key에서 파생된 key (압축 variant, 큰 객체의 meta / segment)의 구분자 - "GET http://host:port/path gzip"
+ * request URI에는 공백이 들어갈 수 없으므로 '#'과 달리 진짜 key와 겹치지 않음
+ */
+#define CACHE_KEY_SEP ' '
+/* 큰 객체의 응답 헤더를 두는 파생 key의 접미사 - "key meta" (body 조각은 "key seg<i>") */
+#define CACHE_META_SUFFIX "meta"
+
+/*
+ * 캐시 값(server response) - 응답 헤더 블록과 body를 나눠서 미리 직렬화해 둔 것
+ * hit를 보낼 때 헤더 뒤에 Age, X-Cache 같은 응답별 헤더를 끼우고 body는 복사 없이 그대로 (writev)
+ * 참조는 캐시가 하나, cache_acquire로 받아 간 요청이 하나씩 - 마지막 cobj_put에서 free
+ * 메모리는 malloc 대신 cmem (huge page, 만든 스레드의 NUMA 노드)
+ */
+typedef struct cobj {
+    atomic_long refs;
+    atomic_int ref;       /* CLOCK 참조 비트 - hit되면 1, hand가 지나가면 0 */
+    atomic_ulong gen;     /* 캐시에 들어갈 때 받은 세대 번호, 캐시에서 빠지면 0 (L1이 아직 유효한지 확인) */
+    size_t hlen;          /* 헤더 블록 (status line ~ 빈 줄) 바이트 수, HTTP 응답이 아니면 0 */
+    size_t size;          /* 헤더 + body 바이트 수 */
+    time_t stored;        /* 메모리 캐시에 들어온 시각 (Age) */
+    time_t expires;       /* 이 시각부터는 miss로 (음성 캐시 - 404, DNS 실패), 0이면 만료 없음 */
+    int node;             /* 놓인 NUMA 노드 (cmem) */
+    atomic_int no_enc;    /* 압축해도 줄지 않는 ENC_* 비트 (compress가 기록) - hit 때 다시 압축하지 않음 */
+    unsigned long pseq;   /* 메모리 캐시에 처음 들어올 때의 purge 순번 - 디스크에도 같이 적어서 그 뒤의 purge만 거름 */
+    char data[];          /* 헤더 블록 바로 뒤에 body */
+} cobj_t;
+
+/*
  * 캐시(client request)-값(server response) 저장할 노드 구조체
+ * next는 hash bucket 체인 (reader가 lock 없이 따라감), cprev/cnext는 CLOCK 원형 리스트 (writer만)
  */
 typedef struct cnode {
     char *key;
-    char *value;
-    struct cnode *prev;
-    struct cnode *next;
+    cobj_t *obj;          /* binary 응답도 저장할 수 있도록 길이와 함께 */
+    unsigned long hash;
+    _Atomic(struct cnode *) next;
+    struct cnode *cprev;
+    struct cnode *cnext;
+    unsigned long retired; /* 쫓겨난 epoch - 이 뒤로 2 epoch이 지나면 free */
+    struct cnode *gc_next; /* 쫓겨나서 free를 기다리는 노드 리스트 (purge할 때 찾은 노드 리스트로도) */
+    struct tlink *tags;    /* 이 노드가 걸린 tag들 (cindex) */
 } cnode_t;
 
-/* 
- * 전체 캐시 노드들을 포함할 구조체 
- * LRU 노드를 가장 앞에 둔 linked list로 이루어짐
+/*
+ * 전체 캐시 노드들을 포함할 구조체
+ * hash bucket 배열이 index, 교체는 CLOCK (hand가 가리키는 노드가 가장 오래된 쪽)
  */
 typedef struct cache {
-    cnode_t *head;
-    cnode_t *tail;
+    _Atomic(cnode_t *) *buckets;
+    unsigned long nbuckets;   /* 2의 거듭제곱 */
+    cnode_t *hand;
     size_t size;
+    size_t capacity;      /* size 상한 - 넘으면 hand부터 쫓아냄 */
+    long entries;         /* 노드 수 */
+    long evictions;       /* 공간이 없어 쫓아낸 노드 수 (누적) */
+    long sync_evictions;  /* 그중 cache_place가 직접 쫓아낸 수 (reclaimer가 못 따라간 경우) */
+    long purged;          /* cache_purge*로 지운 노드 수 (누적) */
+    unsigned long gen;    /* 마지막으로 준 세대 번호 */
+    cnode_t *limbo;       /* 쫓겨났지만 아직 읽는 reader가 있을 수 있는 노드들 (최근 것이 앞) */
 } cache_t;
 
+/* 통계용 캐시 상태 스냅샷 */
+typedef struct cache_stats {
+    size_t size;
+    size_t capacity;
+    long entries;
+    long evictions;
+    long sync_evictions;
+    long purged;
+    long hits_local;      /* 객체가 hit한 스레드와 같은 NUMA 노드에 있었던 hit */
+    long hits_remote;
+    long hits_l1;         /* 그중 연결 slot의 L1에서 끝난 hit */
+} cache_stats_t;
+
+/*
+ * L1 - 연결 slot마다 하나씩 있는 작은 hot 객체 캐시 (cache_l1_bind로 지금 스레드에 붙임)
+ * 공유 캐시에서 hit된 작은 객체의 참조를 들고 있다가 다음 hit는 공유 index를 안 거치고 바로 준다.
+ * 객체의 gen이 받을 때와 같을 때만 (= 아직 공유 캐시에 있을 때만) 유효
+ */
+typedef struct cache_l1 cache_l1_t;
+
 
 void cache_init();
-void cache_place(char *key,char *value);
-int  cache_get(char *key,char *value);
+void cache_init_capacity(size_t capacity);
+int cache_reclaimer_start(void);
+void cache_place(char *key,char *value,size_t size);
+void cache_place_ttl(char *key,char *value,size_t size,int ttl);
+int cache_place_derived(char *key,char *value,size_t size,cobj_t *base);
+size_t cache_get(char *key,char *value);
+cobj_t *cache_acquire(char *key);
+void cobj_get(cobj_t *obj);
+void cobj_put(cobj_t *obj);
+cache_l1_t *cache_l1_new(void);
+void cache_l1_bind(cache_l1_t *l1);
+long cache_purge(const char *key);
+long cache_purge_prefix(const char *prefix);
+long cache_purge_tag(const char *tag);
 void cache_destroy();
+void cache_stats(cache_stats_t *st);
+void cache_walk(void (*fn)(const char *key, const char *value, size_t size, void *arg), void *arg);
 
-#endif
\ No newline at end of file
+#endif
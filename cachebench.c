@@ -0,0 +1,206 @@
+/*
+ * < cachebench.c >
+ * cache.c 마이크로벤치마크
+ *
+ * code/의 CPE 측정 코드(cpe.c, fcyc.c, clock.c)를 그대로 가져다 쓴다.
+ * 연산 cnt번을 하는 함수를 여러 cnt로 재고 최소제곱 기울기를 구하면 -> 연산 1번당 cycle (CPE)
+ *
+ *   get_hit  : 캐시에 있는 key로 cache_get (CLOCK ref 비트 표시 포함)
+ *   get_miss : 없는 key로 cache_get (bucket 체인 하나 순회)
+ *   place    : 꽉 찬 캐시에 cache_place (CLOCK으로 하나 쫓아내고 새로 넣음)
+ *
+ * 노드 수(-n), key 길이(-k), 스레드 수(-t) 조합마다 한 줄씩 CSV로 출력.
+ * 스레드가 2개 이상이면 나머지 스레드는 측정 내내 cache_get hit를 계속 돌린다.
+ * clock.c는 스레드 CPU 시간을 cycle로 바꾸므로 writer lock에서 잠든 시간은 cycles_per_op에
+ * 안 들어간다 -> 락 경합은 벽시계로 잰 ns_per_op 쪽에서 본다.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "cpe.h"
+#include "clock.h"
+
+#define MAX_LIST 16
+#define MAX_CNT 2000      /* CPE 측정 때 cnt 최댓값 */
+#define WALL_OPS 20000    /* ns_per_op 측정 때 연산 수 */
+
+typedef enum { OP_GET_HIT, OP_GET_MISS, OP_PLACE } op_t;
+static const char *op_names[] = {"get_hit", "get_miss", "place"};
+
+/* ------------ global var ------------ */
+static char **keys;        /* [0, n) : 캐시에 넣어 둔 key, [n, 2n) : 없는 key */
+static long nkeys;
+static long cursor;        /* place가 다음에 넣을 key 위치 */
+static char *value, *out;
+static size_t value_size = 1024;
+static volatile int stop;
+
+/* ------------ routine ------------ */
+/* 실제 key(다시 쓴 요청 메세지)처럼 앞쪽에 구분되는 path, 뒤에 공통 헤더를 채움 */
+static char *make_key(long id, int len)
+{
+  char *k = Malloc(len + 1);
+  int n = snprintf(k, len + 1, "GET /obj%08ld HTTP/1.0\r\nHost: bench\r\n", id);
+  if (n < len)
+    memset(k + n, 'x', len - n);
+  k[len] = '\0';
+  return k;
+}
+
+static void setup(long n, int keylen)
+{
+  long i;
+  nkeys = n;
+  keys = Malloc(2 * n * sizeof(char *));
+  for (i = 0; i < 2 * n; i++)
+    keys[i] = make_key(i, keylen);
+  /* 딱 n개가 들어가는 용량 -> place는 매번 하나씩 쫓아냄 */
+  cache_init_capacity(n * (keylen + value_size + sizeof(char *)));
+  for (i = n - 1; i >= 0; i--)
+    cache_place(keys[i], value, value_size);
+  cursor = n;
+}
+
+static void teardown(void)
+{
+  long i;
+  cache_destroy();
+  for (i = 0; i < 2 * nkeys; i++)
+    free(keys[i]);
+  free(keys);
+}
+
+/* hit는 쫓겨나지 않은 key만 써야 함 - place 측정 중엔 이미 바뀌어 있을 수 있어 매번 setup */
+static void get_hit(long cnt)
+{
+  long i;
+  for (i = 0; i < cnt; i++)
+    cache_get(keys[(i * 7) % nkeys], out);
+}
+
+static void get_miss(long cnt)
+{
+  long i;
+  for (i = 0; i < cnt; i++)
+    cache_get(keys[nkeys + i % nkeys], out);
+}
+
+/* 캐시에는 최근에 넣은 n개만 남으므로 2n개를 돌려 쓰면 항상 없는 key를 넣게 됨 */
+static void place(long cnt)
+{
+  long i;
+  for (i = 0; i < cnt; i++)
+  {
+    cache_place(keys[cursor], value, value_size);
+    cursor = (cursor + 1) % (2 * nkeys);
+  }
+}
+
+static elem_fun_t op_funs[] = {get_hit, get_miss, place};
+
+/*
+ * 방해 스레드 - stop이 설 때까지 쉬지 않고 hit
+ * reader는 lock을 잡지 않으므로 place(writer)가 굶지 않는다.
+ */
+static void *noise(void *vargp)
+{
+  char *buf = Malloc(value_size);
+  long i = (long)vargp;
+  while (!stop)
+    cache_get(keys[(i++ * 13) % nkeys], buf);
+  free(buf);
+  return NULL;
+}
+
+static double wall_ns_per_op(elem_fun_t f)
+{
+  struct timespec a, b;
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  f(WALL_OPS);
+  clock_gettime(CLOCK_MONOTONIC, &b);
+  return ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec)) / WALL_OPS;
+}
+
+static int parse_list(char *s, long *list)
+{
+  int n = 0;
+  char *tok;
+  for (tok = strtok(s, ","); tok != NULL && n < MAX_LIST; tok = strtok(NULL, ","))
+    list[n++] = atol(tok);
+  return n;
+}
+
+static void usage(char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-n entries,...] [-k keylen,...] [-t threads,...] [-v value_size] [-o op]\n"
+          "  -n  entry counts, default 16,64,256,1024\n"
+          "  -k  key lengths in bytes, default 64,256,1024\n"
+          "  -t  thread counts (extra threads run cache_get hits), default 1,4\n"
+          "  -v  value size in bytes, default 1024\n"
+          "  -o  only run get_hit, get_miss or place\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  char nlist_s[] = "16,64,256,1024", klist_s[] = "64,256,1024", tlist_s[] = "1,4";
+  long nlist[MAX_LIST], klist[MAX_LIST], tlist[MAX_LIST];
+  int nn, nk, nt, opt, only = -1, a, b, c, op;
+  long i;
+  pthread_t tids[64];
+  double cpe, ns;
+
+  nn = parse_list(nlist_s, nlist);
+  nk = parse_list(klist_s, klist);
+  nt = parse_list(tlist_s, tlist);
+  while ((opt = getopt(argc, argv, "n:k:t:v:o:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n': nn = parse_list(optarg, nlist); break;
+    case 'k': nk = parse_list(optarg, klist); break;
+    case 't': nt = parse_list(optarg, tlist); break;
+    case 'v': value_size = atol(optarg); break;
+    case 'o':
+      for (op = 0; op < 3 && strcmp(optarg, op_names[op]); op++)
+        ;
+      if ((only = op) == 3)
+        usage(argv[0]);
+      break;
+    default: usage(argv[0]);
+    }
+  }
+  value = Calloc(value_size, 1);
+  out = Malloc(value_size);
+  mhz(0);
+
+  printf("op,entries,keylen,threads,cycles_per_op,ns_per_op\n");
+  for (op = 0; op < 3; op++)
+  {
+    if (only >= 0 && op != only)
+      continue;
+    for (a = 0; a < nn; a++)
+      for (b = 0; b < nk; b++)
+        for (c = 0; c < nt; c++)
+        {
+          if (nlist[a] <= 0 || klist[b] < 32 || tlist[c] < 1 || tlist[c] > 64)
+            usage(argv[0]);
+          setup(nlist[a], klist[b]);
+          stop = 0;
+          for (i = 1; i < tlist[c]; i++)
+            Pthread_create(&tids[i], NULL, noise, (void *)i);
+          cpe = find_cpe_full(op_funs[op], MAX_CNT, 10, NULL, UNI_SAMPLE, 0.1, 0);
+          ns = wall_ns_per_op(op_funs[op]);
+          stop = 1;
+          for (i = 1; i < tlist[c]; i++)
+            Pthread_join(tids[i], NULL);
+          teardown();
+          printf("%s,%ld,%ld,%ld,%.1f,%.1f\n", op_names[op], nlist[a], klist[b], tlist[c], cpe, ns);
+          fflush(stdout);
+        }
+  }
+  free(value);
+  free(out);
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * < cachesim.c >
+ * 오프라인 캐시 시뮬레이터
+ *
+ * proxy access log(-l)를 trace로 읽어서 proxy가 쓰는 cache.c를 그대로 돌려보고,
+ * 캐시 크기별 hit 비율을 CSV로 출력한다. 네트워크 없이 정책/크기만 비교할 때 사용.
+ *
+ *   ./cachesim [-m min_bytes] [-M max_bytes] [-f factor] [-o max_object] trace.jsonl
+ *
+ * - key는 요청 URL, 크기는 로그의 bytes(헤더 포함해서 client에 보낸 바이트)
+ * - miss면 proxy와 똑같이 max_object 이하일 때만 cache_place
+ * - 출력 : capacity,requests,hits,hit_ratio,byte_hit_ratio,evictions
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "trace.h"
+
+#define MAX_OBJECT_SIZE 102400
+
+static void usage(char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-m min_bytes] [-M max_bytes] [-f factor] [-o max_object] trace\n"
+          "  -m  smallest cache capacity, default 65536\n"
+          "  -M  largest cache capacity, default 67108864\n"
+          "  -f  capacity growth factor between rows, default 2\n"
+          "  -o  largest cacheable object, default %d (the proxy's MAX_OBJECT_SIZE)\n",
+          prog, MAX_OBJECT_SIZE);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  double factor = 2.0, cap;
+  size_t min_cap = 65536, max_cap = 64UL << 20, max_object = MAX_OBJECT_SIZE;
+  trace_rec_t *trace;
+  long ntrace, i, hits, evictions;
+  double bytes, hit_bytes;
+  char *value;
+  cache_stats_t st;
+
+  while ((opt = getopt(argc, argv, "m:M:f:o:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'm': min_cap = strtoul(optarg, NULL, 0); break;
+    case 'M': max_cap = strtoul(optarg, NULL, 0); break;
+    case 'f': factor = atof(optarg); break;
+    case 'o': max_object = strtoul(optarg, NULL, 0); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || factor <= 1.0 || min_cap == 0 || min_cap > max_cap)
+    usage(argv[0]);
+  if ((ntrace = trace_load(argv[optind], &trace)) < 0)
+    unix_error("open trace file");
+  if (ntrace == 0)
+    app_error("trace has no requests");
+
+  /* 응답 내용은 hit 비율과 무관 - 크기만 맞춘 버퍼 하나를 계속 씀 (max_object보다 큰 건 저장 안 함) */
+  value = Calloc(max_object + 1, 1);
+
+  printf("capacity,requests,hits,hit_ratio,byte_hit_ratio,evictions\n");
+  for (cap = min_cap; cap <= max_cap * 1.0001; cap *= factor)
+  {
+    cache_init_capacity((size_t)cap);
+    hits = 0;
+    bytes = hit_bytes = 0;
+    for (i = 0; i < ntrace; i++)
+    {
+      bytes += trace[i].bytes;
+      if (cache_get(trace[i].url, value) > 0)
+      {
+        hits++;
+        hit_bytes += trace[i].bytes;
+      }
+      else if (trace[i].bytes > 0 && (size_t)trace[i].bytes <= max_object && trace[i].bytes <= cap)
+        cache_place(trace[i].url, value, trace[i].bytes);
+    }
+    cache_stats(&st);
+    evictions = st.evictions;
+    cache_destroy();
+    printf("%zu,%ld,%ld,%.4f,%.4f,%ld\n", (size_t)cap, ntrace, hits,
+           (double)hits / ntrace, bytes > 0 ? hit_bytes / bytes : 0.0, evictions);
+    fflush(stdout);
+  }
+  trace_free(trace, ntrace);
+  free(value);
+  return 0;
+}
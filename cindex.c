@@ -0,0 +1,289 @@
+/*
+ * cindex.c - purge용 캐시 key index (radix tree + tag index)
+ *
+ * hash bucket은 key 하나를 찾는 데만 쓸 수 있어서, prefix나 tag로 지우려면 캐시 전체를 훑어야 한다.
+ * 여기서는 캐시에 들어간 노드를 두 가지로 더 걸어 두고 찾는 비용이 걸린 노드 수에만 비례하도록 한다.
+ * 걸고 빼는 건 cache.c가 노드를 넣고 뺄 때 c_lock 안에서 하므로 여기에는 lock이 없다.
+ */
+#include "cindex.h"
+
+/* radix tree 노드 - label은 부모에서 이 노드까지의 key 조각 */
+typedef struct rnode {
+    char *label;
+    size_t len;
+    struct rnode *child;    /* 첫 자식 (자식들은 label 첫 글자가 모두 다름) */
+    struct rnode *sibling;
+    cnode_t *entry;         /* 여기서 끝나는 key의 캐시 노드, 없으면 NULL */
+} rnode_t;
+
+struct tag;
+
+/* tag 하나와 노드 하나의 연결 - tag의 노드 리스트와 노드의 tag 리스트에 같이 걸림 */
+typedef struct tlink {
+    struct tag *tag;
+    cnode_t *node;
+    struct tlink *prev, *next;   /* 같은 tag의 노드들 */
+    struct tlink *nnext;         /* 같은 노드의 tag들 */
+} tlink_t;
+
+typedef struct tag {
+    char *name;
+    tlink_t *head;
+    struct tag *next;            /* hash bucket 체인 */
+} tag_t;
+
+/* ------------ global var ------------ */
+static rnode_t *r_root;
+static tag_t *t_buckets[CINDEX_TAG_BUCKETS];
+
+/* ------------ radix tree ------------ */
+static rnode_t *rnode_new(const char *label, size_t len, cnode_t *entry) {
+  rnode_t *n = (rnode_t *)calloc(1, sizeof(rnode_t));
+
+  n->label = (char *)malloc(len + 1);
+  memcpy(n->label, label, len);
+  n->label[len] = '\0';
+  n->len = len;
+  n->entry = entry;
+  return n;
+}
+
+/* 자식 중 label이 c로 시작하는 것이 걸린 자리 - 없으면 *리턴값이 NULL */
+static rnode_t **rchild(rnode_t *n, char c) {
+  rnode_t **pp;
+
+  for (pp = &n->child; *pp != NULL && (*pp)->label[0] != c; pp = &(*pp)->sibling)
+    ;
+  return pp;
+}
+
+static size_t common_len(const char *a, size_t alen, const char *b, size_t blen) {
+  size_t i;
+
+  for (i = 0; i < alen && i < blen && a[i] == b[i]; i++)
+    ;
+  return i;
+}
+
+static void radix_insert(const char *key, cnode_t *node) {
+  size_t klen = strlen(key), cl;
+  rnode_t *n, **pp, *c, *mid;
+
+  if (r_root == NULL)
+    r_root = rnode_new("", 0, NULL);
+  n = r_root;
+  while (klen > 0) {
+    pp = rchild(n, key[0]);
+    if ((c = *pp) == NULL) {
+      c = rnode_new(key, klen, node);
+      c->sibling = n->child;
+      n->child = c;
+      return;
+    }
+    cl = common_len(c->label, c->len, key, klen);
+    if (cl < c->len) {
+      /* edge 중간에서 갈라짐 - 공통 부분을 새 노드로 나누고 c는 그 아래로 */
+      mid = rnode_new(c->label, cl, NULL);
+      mid->child = c;
+      mid->sibling = c->sibling;
+      *pp = mid;
+      c->sibling = NULL;
+      memmove(c->label, c->label + cl, c->len - cl + 1);
+      c->len -= cl;
+      c = mid;
+    }
+    n = c;
+    key += cl;
+    klen -= cl;
+  }
+  n->entry = node;
+}
+
+/*
+ * *pp 아래에서 key (*pp의 label 다음부터)의 node를 뺌
+ * 빈 노드는 지우고, entry 없이 자식이 하나만 남은 노드는 그 자식과 합쳐서 tree를 압축된 채로 둔다.
+ */
+static void radix_remove(rnode_t **pp, const char *key, size_t klen, cnode_t *node) {
+  rnode_t *n = *pp, **cp, *c;
+  char *label;
+
+  if (klen == 0) {
+    if (n->entry == node)
+      n->entry = NULL;
+  }
+  else {
+    cp = rchild(n, key[0]);
+    if ((c = *cp) == NULL || c->len > klen || memcmp(c->label, key, c->len) != 0)
+      return;
+    radix_remove(cp, key + c->len, klen - c->len, node);
+  }
+
+  if (n == r_root || n->entry != NULL)
+    return;
+  if (n->child == NULL) {
+    *pp = n->sibling;
+    free(n->label);
+    free(n);
+  }
+  else if (n->child->sibling == NULL) {
+    c = n->child;
+    label = (char *)malloc(n->len + c->len + 1);
+    memcpy(label, n->label, n->len);
+    memcpy(label + n->len, c->label, c->len + 1);
+    free(c->label);
+    c->label = label;
+    c->len += n->len;
+    c->sibling = n->sibling;
+    *pp = c;
+    free(n->label);
+    free(n);
+  }
+}
+
+/* n 아래의 모든 entry를 list 앞에 (gc_next로) */
+static void radix_collect(rnode_t *n, cnode_t **list) {
+  for (; n != NULL; n = n->sibling) {
+    if (n->entry != NULL) {
+      n->entry->gc_next = *list;
+      *list = n->entry;
+    }
+    radix_collect(n->child, list);
+  }
+}
+
+/* ------------ tag ------------ */
+/* FNV-1a */
+static unsigned long tag_hash(const char *s, size_t len) {
+  unsigned long h = 0xcbf29ce484222325UL;
+
+  while (len--)
+    h = (h ^ (unsigned char)*s++) * 0x100000001b3UL;
+  return h;
+}
+
+/* 이름이 name[0..len)인 tag - create면 없을 때 만듦 */
+static tag_t *tag_find(const char *name, size_t len, int create) {
+  tag_t **pp = &t_buckets[tag_hash(name, len) % CINDEX_TAG_BUCKETS], *t;
+
+  for (t = *pp; t != NULL; t = t->next)
+    if (strlen(t->name) == len && memcmp(t->name, name, len) == 0)
+      return t;
+  if (!create)
+    return NULL;
+  t = (tag_t *)calloc(1, sizeof(tag_t));
+  t->name = (char *)malloc(len + 1);
+  memcpy(t->name, name, len);
+  t->name[len] = '\0';
+  t->next = *pp;
+  *pp = t;
+  return t;
+}
+
+static void tag_free(tag_t *t) {
+  tag_t **pp = &t_buckets[tag_hash(t->name, strlen(t->name)) % CINDEX_TAG_BUCKETS];
+
+  while (*pp != t)
+    pp = &(*pp)->next;
+  *pp = t->next;
+  free(t->name);
+  free(t);
+}
+
+static void tag_link(cnode_t *node, const char *name, size_t len) {
+  tag_t *t;
+  tlink_t *l;
+
+  for (l = node->tags; l != NULL; l = l->nnext)
+    if (strlen(l->tag->name) == len && memcmp(l->tag->name, name, len) == 0)
+      return; /* 같은 tag가 두 번 */
+  t = tag_find(name, len, 1);
+  l = (tlink_t *)malloc(sizeof(tlink_t));
+  l->tag = t;
+  l->node = node;
+  l->prev = NULL;
+  l->next = t->head;
+  if (t->head != NULL)
+    t->head->prev = l;
+  t->head = l;
+  l->nnext = node->tags;
+  node->tags = l;
+}
+
+/* ------------ routine ------------ */
+/*
+ * 노드를 index에 건다 (node->key로 radix tree, tags의 공백으로 나뉜 tag마다 tag index)
+ * tags : Surrogate-Key 헤더 값, 없으면 NULL
+ */
+void cindex_add(cnode_t *node, const char *tags, size_t tags_len) {
+  const char *p, *end = tags + tags_len, *s;
+
+  radix_insert(node->key, node);
+  node->tags = NULL;
+  for (p = tags; p != NULL && p < end; ) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    for (s = p; p < end && *p != ' ' && *p != '\t'; p++)
+      ;
+    if (p > s && p - s <= CINDEX_MAX_TAG)
+      tag_link(node, s, p - s);
+  }
+}
+
+/* 노드를 index에서 뺌 - 마지막 노드가 빠진 tag는 지움 */
+void cindex_remove(cnode_t *node) {
+  tlink_t *l;
+
+  radix_remove(&r_root, node->key, strlen(node->key), node);
+  while ((l = node->tags) != NULL) {
+    node->tags = l->nnext;
+    if (l->prev != NULL)
+      l->prev->next = l->next;
+    else
+      l->tag->head = l->next;
+    if (l->next != NULL)
+      l->next->prev = l->prev;
+    if (l->tag->head == NULL)
+      tag_free(l->tag);
+    free(l);
+  }
+}
+
+/* key가 prefix로 시작하는 노드들 (gc_next 리스트) */
+cnode_t *cindex_prefix(const char *prefix) {
+  size_t plen = strlen(prefix), cl;
+  rnode_t *n = r_root, *c;
+  cnode_t *list = NULL;
+
+  if (n == NULL)
+    return NULL;
+  while (plen > 0) {
+    if ((c = *rchild(n, prefix[0])) == NULL)
+      return NULL;
+    cl = common_len(c->label, c->len, prefix, plen);
+    if (cl < plen && cl < c->len)
+      return NULL;
+    n = c;
+    prefix += cl;
+    plen -= cl;
+  }
+  /* prefix가 n의 label 중간에서 끝나도 n 아래는 전부 해당 */
+  if (n->entry != NULL) {
+    n->entry->gc_next = list;
+    list = n->entry;
+  }
+  radix_collect(n->child, &list);
+  return list;
+}
+
+/* tag를 단 노드들 (gc_next 리스트) */
+cnode_t *cindex_tag(const char *tag) {
+  tag_t *t = tag_find(tag, strlen(tag), 0);
+  tlink_t *l;
+  cnode_t *list = NULL;
+
+  for (l = t != NULL ? t->head : NULL; l != NULL; l = l->next) {
+    l->node->gc_next = list;
+    list = l->node;
+  }
+  return list;
+}
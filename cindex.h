@@ -0,0 +1,22 @@
+#ifndef __CINDEX_H__
+#define __CINDEX_H__
+
+#include "cache.h"
+
+/*
+ * 캐시 key index (purge용) - 모두 cache.c의 writer lock(c_lock) 안에서만 부른다.
+ * - radix tree : key ("GET http://host:port/path", variant, segment key 포함)로 prefix 검색
+ *                /static/ 아래를 지우면 그 밑의 gzip, seg 같은 파생 key (CACHE_KEY_SEP 뒤)도 같이 걸린다.
+ * - tag index : 응답의 Surrogate-Key 헤더에 있는 tag -> 그 tag를 단 노드들
+ * 찾은 노드는 gc_next로 이어서 리턴 (살아 있는 노드는 gc_next를 안 쓰므로)
+ */
+
+#define CINDEX_TAG_BUCKETS 1024
+#define CINDEX_MAX_TAG 128       /* 이보다 긴 tag는 무시 */
+
+void     cindex_add(cnode_t *node, const char *tags, size_t tags_len);
+void     cindex_remove(cnode_t *node);
+cnode_t *cindex_prefix(const char *prefix);
+cnode_t *cindex_tag(const char *tag);
+
+#endif
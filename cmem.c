@@ -0,0 +1,239 @@
+/*
+ * cmem.c - 캐시 객체용 huge page / NUMA 메모리
+ *
+ * sched_getcpu()와 MAP_HUGETLB가 GNU 확장이라 _GNU_SOURCE가 필요한데, csapp.h와 같이 쓰면
+ * 선언이 충돌하므로 relay.c처럼 csapp.h를 include하지 않는 별도 파일로 둔다.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "cmem.h"
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1   /* <numaif.h> (libnuma) 없이 mbind를 부르기 위해 */
+#endif
+
+#define CMEM_HDR 64        /* chunk 앞의 chdr_t 자리 - slot이 cache line에 맞도록 64 */
+#define CMEM_CLASSES 45    /* 64B, 80B, 96B, 112B, 128B, 160B, ... 128KB (2의 거듭제곱 사이를 4등분) */
+#define CMEM_MAX_CPUS 1024
+
+/* chunk 맨 앞 - 객체 주소를 CMEM_CHUNK 경계로 내리면 여기 */
+typedef struct {
+    int node;
+    int cls;              /* -1이면 큰 객체 하나짜리 chunk */
+    size_t len;           /* mmap 길이 */
+} chdr_t;
+
+/* 노드 하나, class 하나의 slot들 */
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    void *free;           /* 반납된 slot 리스트 (slot 첫 8바이트가 next) */
+    char *bump;           /* 지금 chunk에서 아직 안 쓴 부분 */
+    char *end;
+} pool_t;
+
+/* ------------ global var ------------ */
+static pool_t c_pools[CMEM_MAX_NODES][CMEM_CLASSES];
+static pthread_once_t c_once = PTHREAD_ONCE_INIT;
+static int c_nnodes = 1;                    /* cmem_init 전에는 노드 하나로 */
+static unsigned char c_cpu_node[CMEM_MAX_CPUS];
+static int c_huge;                          /* MADV_HUGEPAGE */
+static int c_hugetlb;                       /* MAP_HUGETLB 먼저 */
+static atomic_size_t c_mapped[CMEM_MAX_NODES];
+
+/* ------------ routine ------------ */
+static void pools_init(void) {
+  int n, c;
+
+  for (n = 0; n < CMEM_MAX_NODES; n++)
+    for (c = 0; c < CMEM_CLASSES; c++)
+      pthread_mutex_init(&c_pools[n][c].lock, NULL);
+}
+
+/* size가 들어가는 가장 작은 class */
+static int class_of(size_t size) {
+  int shift;
+  size_t base;
+
+  if (size <= 64)
+    return 0;
+  shift = 63 - __builtin_clzl(size - 1); /* 2^shift < size <= 2^(shift+1) */
+  base = 1UL << shift;
+  return 1 + (shift - 6) * 4 + (int)((size - base - 1) / (base / 4));
+}
+
+static size_t class_size(int cls) {
+  size_t base;
+
+  if (cls == 0)
+    return 64;
+  base = 1UL << (6 + (cls - 1) / 4);
+  return base + ((cls - 1) % 4 + 1) * (base / 4);
+}
+
+/* "0-3,8-11" 형식의 cpulist를 읽어서 c_cpu_node에 */
+static int read_cpulist(int node) {
+  char path[64];
+  FILE *f;
+  int lo, hi, cpu;
+  char sep;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  if ((f = fopen(path, "r")) == NULL)
+    return -1;
+  while (fscanf(f, "%d", &lo) == 1) {
+    hi = lo;
+    if ((sep = fgetc(f)) == '-') {
+      if (fscanf(f, "%d", &hi) != 1)
+        break;
+      sep = fgetc(f);
+    }
+    for (cpu = lo; cpu <= hi && cpu < CMEM_MAX_CPUS; cpu++)
+      c_cpu_node[cpu] = node;
+    if (sep != ',')
+      break;
+  }
+  fclose(f);
+  return 0;
+}
+
+/*
+ * 노드 구성 읽기 (cache_init 전에 한 번) - /sys에 노드 정보가 없으면 노드 하나로
+ * capacity : 메모리 캐시 크기 (huge page를 쓸지), hugetlb : MAP_HUGETLB를 먼저 시도할지
+ */
+int cmem_init(size_t capacity, int hugetlb) {
+  int node;
+
+  pthread_once(&c_once, pools_init);
+  for (node = 0; node < CMEM_MAX_NODES; node++)
+    if (read_cpulist(node) == 0)
+      c_nnodes = node + 1;
+  c_huge = capacity >= CMEM_HUGE_MIN;
+  c_hugetlb = hugetlb;
+  return c_nnodes;
+}
+
+int cmem_nodes(void) {
+  return c_nnodes;
+}
+
+/* 지금 이 스레드가 돌고 있는 CPU의 노드 */
+int cmem_self_node(void) {
+  int cpu;
+
+  if (c_nnodes == 1)
+    return 0;
+  cpu = sched_getcpu();
+  return cpu >= 0 && cpu < CMEM_MAX_CPUS ? c_cpu_node[cpu] : 0;
+}
+
+/* len(CMEM_CHUNK 배수로 올림)짜리 chunk를 CMEM_CHUNK 경계에 잡고 node에 붙임 */
+static chdr_t *chunk_map(size_t len, int node, int cls) {
+  char *p = MAP_FAILED;
+  size_t head;
+  unsigned long mask;
+  chdr_t *h;
+
+  len = (len + CMEM_CHUNK - 1) & ~(CMEM_CHUNK - 1);
+  if (c_hugetlb)
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p == MAP_FAILED) {
+    /* 경계에 맞추려고 chunk 하나만큼 더 잡고 앞뒤를 잘라냄 */
+    if ((p = mmap(NULL, len + CMEM_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+      return NULL;
+    head = -(uintptr_t)p & (CMEM_CHUNK - 1);
+    if (head > 0)
+      munmap(p, head);
+    munmap(p + head + len, CMEM_CHUNK - head);
+    p += head;
+    if (c_huge)
+      madvise(p, len, MADV_HUGEPAGE);
+  }
+  /* 페이지는 처음 쓸 때 잡히므로 그 전에 노드를 정해 둠 (모자라면 다른 노드에서라도) */
+  if (c_nnodes > 1) {
+    mask = 1UL << node;
+    syscall(SYS_mbind, p, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+  }
+  h = (chdr_t *)p;
+  h->node = node;
+  h->cls = cls;
+  h->len = len;
+  atomic_fetch_add(&c_mapped[node], len);
+  return h;
+}
+
+static chdr_t *chunk_of(const void *p) {
+  return (chdr_t *)((uintptr_t)p & ~(CMEM_CHUNK - 1));
+}
+
+/*
+ * 이 스레드의 노드에서 size 바이트 - 실패하면 NULL
+ * class 크기가 16의 배수라 16바이트 정렬까지만 보장 (64의 배수인 class와 CMEM_MAX_CLASS보다 큰 할당은 64바이트)
+ */
+void *cmem_alloc(size_t size) {
+  int node = cmem_self_node(), cls;
+  pool_t *pl;
+  chdr_t *h;
+  void *p;
+
+  pthread_once(&c_once, pools_init);
+  if (size > CMEM_MAX_CLASS) {
+    if ((h = chunk_map(CMEM_HDR + size, node, -1)) == NULL)
+      return NULL;
+    return (char *)h + CMEM_HDR;
+  }
+  cls = class_of(size);
+  pl = &c_pools[node][cls];
+  pthread_mutex_lock(&pl->lock);
+  if ((p = pl->free) != NULL)
+    pl->free = *(void **)p;
+  else {
+    /* 남은 부분에 안 들어가면 새 chunk (남은 건 버림 - slot 하나보다 작음) */
+    if (pl->bump == NULL || (size_t)(pl->end - pl->bump) < class_size(cls)) {
+      if ((h = chunk_map(CMEM_CHUNK, node, cls)) == NULL) {
+        pthread_mutex_unlock(&pl->lock);
+        return NULL;
+      }
+      pl->bump = (char *)h + CMEM_HDR;
+      pl->end = (char *)h + CMEM_CHUNK;
+    }
+    p = pl->bump;
+    pl->bump += class_size(cls);
+  }
+  pthread_mutex_unlock(&pl->lock);
+  return p;
+}
+
+/* 할당한 노드, class로 반납 - 다른 노드의 스레드가 free해도 원래 노드로 */
+void cmem_free(void *p) {
+  chdr_t *h = chunk_of(p);
+  pool_t *pl;
+
+  if (h->cls < 0) {
+    atomic_fetch_sub(&c_mapped[h->node], h->len);
+    munmap(h, h->len);
+    return;
+  }
+  pl = &c_pools[h->node][h->cls];
+  pthread_mutex_lock(&pl->lock);
+  *(void **)p = pl->free;
+  pl->free = p;
+  pthread_mutex_unlock(&pl->lock);
+}
+
+/* p가 놓인 노드 */
+int cmem_node(const void *p) {
+  return chunk_of(p)->node;
+}
+
+/* metrics용 - node에 mmap해 둔 바이트 수 */
+size_t cmem_mapped(int node) {
+  return atomic_load(&c_mapped[node]);
+}
@@ -0,0 +1,28 @@
+#ifndef __CMEM_H__
+#define __CMEM_H__
+
+#include <stddef.h>
+
+/*
+ * 캐시 객체 저장용 메모리 (cache.c의 cobj_t)
+ * glibc malloc 대신 mmap으로 CMEM_CHUNK(2MB, huge page 하나) 단위 chunk를 잡아서 크기 class별로 나눠 쓴다.
+ * - huge page : 캐시가 CMEM_HUGE_MIN 이상이면 chunk에 MADV_HUGEPAGE (-H면 hugetlbfs 페이지를 먼저 시도)
+ * - NUMA : chunk는 NUMA 노드별로 따로 - 할당한 스레드가 돌고 있는 노드에 mbind해서,
+ *          객체를 받아 온 (miss) 스레드 쪽 메모리에 놓는다.
+ * chunk는 OS에 돌려주지 않고 같은 class, 같은 노드에서 다시 쓴다. (CMEM_MAX_CLASS보다 큰 것만 바로 munmap)
+ */
+
+#define CMEM_CHUNK (2UL << 20)
+#define CMEM_MAX_CLASS (128UL << 10)     /* 이보다 크면 객체 하나에 chunk 하나 */
+#define CMEM_HUGE_MIN (64UL << 20)       /* 캐시가 이보다 작으면 huge page를 안 씀 (다 못 채우는 2MB가 아까움) */
+#define CMEM_MAX_NODES 8
+
+int    cmem_init(size_t capacity, int hugetlb);
+void  *cmem_alloc(size_t size);
+void   cmem_free(void *p);
+int    cmem_node(const void *p);
+int    cmem_self_node(void);
+int    cmem_nodes(void);
+size_t cmem_mapped(int node);
+
+#endif
@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "compress.h"
+#include "cache.h"
+
+/* gzip 압축 레벨 (1~9), brotli quality (0~11) - 한 번만 압축하니 기본보다 조금 세게 */
+#define GZIP_LEVEL 6
+#define BROTLI_QUALITY 5
+
+/* 압축 작업 하나 - key, 응답 모두 복사본 */
+typedef struct {
+    char *key;
+    char *response;
+    size_t len;
+    size_t hlen;          /* 헤더(빈 줄 포함) 길이 = body 시작 */
+} cjob_t;
+
+/* ------------ global var ------------ */
+static int c_enabled;
+static pthread_mutex_t c_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t c_ready = PTHREAD_COND_INITIALIZER;
+static cjob_t c_queue[COMPRESS_QUEUE_LEN];
+static int c_head, c_count;           /* c_queue[c_head] 부터 c_count개 */
+static compress_stats_t c_stats;
+
+static void *compress_worker(void *vargp);
+
+/* ------------ routine ------------ */
+/* 압축 스레드 시작 */
+int compress_init(void) {
+  pthread_t tid;
+
+  if (pthread_create(&tid, NULL, compress_worker, NULL) != 0)
+    return -1;
+  pthread_detach(tid);
+  c_enabled = 1;
+  return 0;
+}
+
+int compress_enabled(void) {
+  return c_enabled;
+}
+
+const char *compress_name(int enc) {
+  return enc == ENC_BR ? "br" : "gzip";
+}
+
+/* [p, p+len)에서 word가 (대소문자 무시하고) 처음 나오는 곳, 없으면 NULL */
+static const char *find(const char *p, size_t len, const char *word) {
+  size_t n = strlen(word), i;
+  for (i = 0; i + n <= len; i++)
+    if (strncasecmp(p + i, word, n) == 0)
+      return p + i;
+  return NULL;
+}
+
+/*
+ * Accept-Encoding 값 -> 받을 수 있는 ENC_* 비트 (이 빌드가 만들 수 있는 것만)
+ * q=0 인 항목은 거부로 본다. "*"는 gzip으로.
+ */
+int compress_accept(const char *value, size_t len) {
+  const char *p = value, *end = value + len, *tok, *semi, *q;
+  size_t n;
+  int enc = 0, bit;
+
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+      p++;
+    tok = p;
+    while (p < end && *p != ',')
+      p++;
+    for (semi = tok; semi < p && *semi != ';'; semi++)
+      ;
+    n = semi - tok;
+    while (n > 0 && (tok[n - 1] == ' ' || tok[n - 1] == '\t'))
+      n--;
+    if ((n == 4 && strncasecmp(tok, "gzip", 4) == 0) || (n == 1 && *tok == '*'))
+      bit = ENC_GZIP;
+#ifdef HAVE_BROTLI
+    else if (n == 2 && strncasecmp(tok, "br", 2) == 0)
+      bit = ENC_BR;
+#endif
+    else
+      continue;
+    /* ;q=0 (q=0.0 ...) 이면 받지 않겠다는 뜻 */
+    if ((q = find(semi, p - semi, "q=")) != NULL && strtod(q + 2, NULL) <= 0.0)
+      continue;
+    enc |= bit;
+  }
+  return enc;
+}
+
+/*
+ * 응답 헤더 한 줄(line, '\0' 필요 X)을 보고 *state의 CH_* 비트를 갱신
+ * 다 본 뒤 (state & (CH_TYPE | CH_NO)) == CH_TYPE 이면 압축 variant를 만들 수 있는 응답
+ */
+void compress_check_header(const char *line, size_t len, int *state) {
+  const char *v;
+  size_t vlen;
+
+  if ((v = memchr(line, ':', len)) == NULL)
+    return;
+  vlen = len - (v + 1 - line);
+  v++;
+  while (vlen > 0 && (*v == ' ' || *v == '\t'))
+    v++, vlen--;
+  while (vlen > 0 && (v[vlen - 1] == '\r' || v[vlen - 1] == '\n' || v[vlen - 1] == ' '))
+    vlen--;
+
+  if (strncasecmp(line, "Content-type:", 13) == 0) {
+    if ((vlen >= 5 && strncasecmp(v, "text/", 5) == 0) ||
+        find(v, vlen, "javascript") || find(v, vlen, "json") || find(v, vlen, "xml"))
+      *state |= CH_TYPE;
+  }
+  else if (strncasecmp(line, "Content-Encoding:", 17) == 0 ||
+           strncasecmp(line, "Transfer-Encoding:", 18) == 0 ||
+           strncasecmp(line, "Content-Range:", 14) == 0)
+    *state |= CH_NO;  /* 이미 인코딩됐거나 일부분 */
+  else if (strncasecmp(line, "Cache-Control:", 14) == 0 && find(v, vlen, "no-transform"))
+    *state |= CH_NO;
+  else if (strncasecmp(line, "Vary:", 5) == 0) {
+    /* Accept-Encoding만으로 달라지는 건 우리와 같음, 다른 헤더로도 달라지면 건드리지 않음 */
+    if (vlen == 15 && strncasecmp(v, "Accept-Encoding", 15) == 0)
+      *state |= CH_VARY;
+    else
+      *state |= CH_NO;
+  }
+}
+
+/*
+ * 다 받아 둔 응답에 miss 경로와 같은 헤더 정리 - 압축 variant를 만들 수 있는 200 응답이면
+ * 빈 줄 앞에 Vary: Accept-Encoding을 끼움 (prefetch처럼 헤더를 줄 단위로 읽지 않는 곳에서)
+ * 리턴값 : 새 길이, max를 넘어서 끼울 수 없으면 0
+ */
+size_t compress_add_vary(char *response, size_t len, size_t max) {
+  static const char vary[] = "Vary: Accept-Encoding\r\n";
+  char *p, *end = response + len, *eol;
+  int state = 0;
+
+  if (!c_enabled || len < 12 || strncmp(response + 9, "200", 3) != 0)
+    return len;
+  for (p = response; p < end; p = eol) {
+    eol = memchr(p, '\n', end - p);
+    eol = eol ? eol + 1 : end;
+    if (eol - p <= 2 && (*p == '\r' || *p == '\n'))
+      break;
+    compress_check_header(p, eol - p, &state);
+  }
+  if (p == end || (state & (CH_TYPE | CH_VARY | CH_NO)) != CH_TYPE)
+    return len;
+  if (len + sizeof(vary) - 1 > max)
+    return 0;
+  memmove(p + sizeof(vary) - 1, p, end - p);
+  memcpy(p, vary, sizeof(vary) - 1);
+  return len + sizeof(vary) - 1;
+}
+
+/*
+ * 캐시에 있는 응답(identity)을 압축 대기열에 넣기만 하고 바로 리턴
+ * 헤더만 훑어서 압축 대상이 아니면 복사하지 않고,
+ * 대기열이 꽉 찼거나 같은 key가 이미 기다리고 있으면 버림
+ */
+void compress_submit(const char *key, const char *response, size_t len) {
+  const char *p, *end = response + len, *eol, *body = NULL;
+  cjob_t *job;
+  int i, state = 0;
+
+  if (!c_enabled)
+    return;
+  /* 200 이고 텍스트 계열, 아직 인코딩 안 된 응답만 */
+  if (len < 12 || strncmp(response + 9, "200", 3) != 0)
+    return;
+  for (p = response; p < end; p = eol) {
+    eol = memchr(p, '\n', end - p);
+    eol = eol ? eol + 1 : end;
+    if (eol - p <= 2 && (*p == '\r' || *p == '\n')) {
+      body = eol;
+      break;
+    }
+    compress_check_header(p, eol - p, &state);
+  }
+  if (body == NULL || (state & (CH_TYPE | CH_NO)) != CH_TYPE || end - body < COMPRESS_MIN_SIZE)
+    return;
+
+  pthread_mutex_lock(&c_lock);
+  for (i = 0; i < c_count; i++)
+    if (strcmp(c_queue[(c_head + i) % COMPRESS_QUEUE_LEN].key, key) == 0)
+      break;
+  if (i < c_count) {
+    pthread_mutex_unlock(&c_lock);
+    return;
+  }
+  if (c_count == COMPRESS_QUEUE_LEN) {
+    c_stats.dropped++;
+    pthread_mutex_unlock(&c_lock);
+    return;
+  }
+  job = &c_queue[(c_head + c_count) % COMPRESS_QUEUE_LEN];
+  job->key = strdup(key);
+  job->response = malloc(len);
+  if (job->key == NULL || job->response == NULL) {
+    free(job->key);
+    free(job->response);
+    pthread_mutex_unlock(&c_lock);
+    return;
+  }
+  memcpy(job->response, response, len);
+  job->len = len;
+  job->hlen = body - response;
+  c_count++;
+  pthread_cond_signal(&c_ready);
+  pthread_mutex_unlock(&c_lock);
+}
+
+/* body를 enc로 압축해서 out에 - 리턴값 : 압축된 크기, 실패하거나 줄지 않으면 0 */
+static size_t encode(int enc, const char *body, size_t len, char *out, size_t cap) {
+  z_stream zs;
+  size_t n;
+
+#ifdef HAVE_BROTLI
+  if (enc == ENC_BR) {
+    n = cap;
+    if (!BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               len, (const uint8_t *)body, &n, (uint8_t *)out))
+      return 0;
+    return n < len ? n : 0;
+  }
+#endif
+  memset(&zs, 0, sizeof(zs));
+  /* windowBits 15 + 16 : zlib이 아닌 gzip 헤더로 */
+  if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return 0;
+  zs.next_in = (Bytef *)body;
+  zs.avail_in = len;
+  zs.next_out = (Bytef *)out;
+  zs.avail_out = cap;
+  n = deflate(&zs, Z_FINISH) == Z_STREAM_END ? zs.total_out : 0;
+  deflateEnd(&zs);
+  return n < len ? n : 0;
+}
+
+/*
+ * 작업의 identity 응답이 아직 캐시에 그대로 있으면 그 객체 (다 쓰면 cobj_put), 아니면 NULL
+ * 대기열에 있는 동안 purge되었거나 key가 다른 응답으로 바뀌었으면 variant를 만들지 않는다.
+ */
+static cobj_t *job_base(cjob_t *job) {
+  cobj_t *obj;
+
+  if ((obj = cache_acquire(job->key)) == NULL)
+    return NULL;
+  if (obj->size == job->len && memcmp(obj->data, job->response, job->len) == 0)
+    return obj;
+  cobj_put(obj);
+  return NULL;
+}
+
+/*
+ * identity 응답 하나로 variant를 만들어 "key gzip", "key br" 로 캐시
+ * 헤더는 Content-length만 바꾸고 Content-Encoding을 붙인다. (Vary는 identity에 이미 있음)
+ * variant는 identity가 캐시에 남아 있을 때만 넣고 (cache_place_derived),
+ * 줄지 않는 encoding (none)은 identity 객체에 기록 - 그 객체가 hit될 때 다시 압축하지 않도록
+ */
+static void compress_job(cjob_t *job) {
+  const char *p, *eol, *body = job->response + job->hlen;
+  char *zbuf, *out, *vkey;
+  cobj_t *base;
+  size_t blen, zcap, n, vlen;
+  int enc, placed = 0, none = 0;
+
+  if ((base = job_base(job)) == NULL)
+    return;
+  blen = job->len - job->hlen;
+  zcap = compressBound(blen) + 1024; /* brotli 최악의 경우도 이 안 */
+  zbuf = malloc(zcap);
+  out = malloc(job->len);
+  vkey = malloc(strlen(job->key) + 8);
+  if (zbuf == NULL || out == NULL || vkey == NULL) {
+    free(zbuf);
+    free(out);
+    free(vkey);
+    cobj_put(base);
+    goto skip;
+  }
+
+  for (enc = ENC_GZIP; enc <= ENC_BR; enc <<= 1) {
+#ifndef HAVE_BROTLI
+    if (enc == ENC_BR)
+      break;
+#endif
+    if ((n = encode(enc, body, blen, zbuf, zcap)) == 0) {
+      none |= enc;
+      continue;
+    }
+    /* 헤더 : Content-length 줄만 빼고 그대로, 마지막 빈 줄 대신 두 줄 + 빈 줄 */
+    vlen = 0;
+    for (p = job->response; p < body; p = eol) {
+      eol = memchr(p, '\n', body - p);
+      eol = eol ? eol + 1 : body;
+      if (eol == body)
+        break; /* 빈 줄 */
+      if (strncasecmp(p, "Content-length:", 15) == 0)
+        continue;
+      memcpy(out + vlen, p, eol - p);
+      vlen += eol - p;
+    }
+    /* 헤더까지 합쳐서 줄지 않으면 identity로 충분 (캐시 버퍼 크기도 identity 이하로 유지) */
+    if (vlen + 64 + n >= job->len) {
+      none |= enc;
+      continue;
+    }
+    vlen += sprintf(out + vlen, "Content-Encoding: %s\r\nContent-length: %zu\r\n\r\n", compress_name(enc), n);
+    memcpy(out + vlen, zbuf, n);
+    sprintf(vkey, "%s%c%s", job->key, CACHE_KEY_SEP, compress_name(enc));
+    if (cache_place_derived(vkey, out, vlen + n, base) < 0)
+      break; /* 그 사이에 identity가 purge됨 */
+    placed++;
+    pthread_mutex_lock(&c_lock);
+    c_stats.variants++;
+    c_stats.saved += job->len - (vlen + n);
+    pthread_mutex_unlock(&c_lock);
+  }
+  free(zbuf);
+  free(out);
+  free(vkey);
+  if (none)
+    atomic_fetch_or(&base->no_enc, none);
+  cobj_put(base);
+  if (placed)
+    return;
+skip:
+  pthread_mutex_lock(&c_lock);
+  c_stats.skipped++;
+  pthread_mutex_unlock(&c_lock);
+}
+
+/* 압축 스레드 - 대기열에서 하나씩 꺼내 압축 (연결 스레드는 기다리지 않음) */
+static void *compress_worker(void *vargp) {
+  cjob_t job;
+
+  while (1) {
+    pthread_mutex_lock(&c_lock);
+    while (c_count == 0)
+      pthread_cond_wait(&c_ready, &c_lock);
+    job = c_queue[c_head];
+    c_head = (c_head + 1) % COMPRESS_QUEUE_LEN;
+    c_count--;
+    pthread_mutex_unlock(&c_lock);
+
+    compress_job(&job);
+    free(job.key);
+    free(job.response);
+  }
+  return NULL;
+}
+
+void compress_stats(compress_stats_t *st) {
+  pthread_mutex_lock(&c_lock);
+  *st = c_stats;
+  pthread_mutex_unlock(&c_lock);
+}
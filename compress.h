@@ -0,0 +1,43 @@
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <stddef.h>
+
+/*
+ * 압축 variant 저장
+ * 텍스트 응답을 캐시에 넣을 때 백그라운드 스레드가 한 번만 gzip(, br)으로 압축해서
+ * "key gzip", "key br" 로 따로 캐시한다. Accept-Encoding이 맞는 클라이언트에게는 그걸 그대로 보낸다.
+ * 압축할 수 있는 응답은 identity에도 Vary: Accept-Encoding을 붙여 둔다.
+ */
+
+#define COMPRESS_MIN_SIZE 256   /* body가 이보다 작으면 압축하지 않음 */
+#define COMPRESS_QUEUE_LEN 64   /* 압축 대기열 길이 - 꽉 차면 버림 */
+
+/* Content-Encoding (Accept-Encoding 비트) */
+enum { ENC_GZIP = 1, ENC_BR = 2 };
+
+/* compress_check_header가 응답 헤더를 보며 모으는 비트 */
+enum {
+    CH_TYPE = 1,          /* 텍스트 계열 Content-type */
+    CH_VARY = 2,          /* 이미 Vary: Accept-Encoding 있음 */
+    CH_NO = 4             /* 압축하면 안 됨 (이미 인코딩, no-transform, 다른 Vary ...) */
+};
+
+/* 통계용 스냅샷 */
+typedef struct compress_stats {
+    long variants;        /* 캐시에 넣은 압축 variant 수 */
+    long skipped;         /* 압축해도 줄지 않아 버린 작업 수 */
+    long dropped;         /* 대기열이 꽉 차서 버린 작업 수 */
+    long saved;           /* 줄인 바이트 수 (variant마다) */
+} compress_stats_t;
+
+int         compress_init(void);
+int         compress_enabled(void);
+int         compress_accept(const char *value, size_t len);
+void        compress_check_header(const char *line, size_t len, int *state);
+size_t      compress_add_vary(char *response, size_t len, size_t max);
+void        compress_submit(const char *key, const char *response, size_t len);
+const char *compress_name(int enc);
+void        compress_stats(compress_stats_t *st);
+
+#endif
@@ -1,6 +1,10 @@
 /* 
  * csapp.c - Functions for the CS:APP3e book
  *
+ * Updated 10/2026:
+ *   - rio_readlineb: scan the internal buffer with memchr and copy whole
+ *     line segments instead of calling rio_read once per byte
+ *
  * Updated 2/2016 droh:
  *   - Updated open_clientfd and open_listenfd to fail more gracefully
  *
@@ -783,18 +787,13 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 
 
 /* 
- * rio_read - This is a wrapper for the Unix read() function that
- *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
- *    buffer, where n is the number of bytes requested by the user and
- *    rio_cnt is the number of unread bytes in the internal buffer. On
- *    entry, rio_read() refills the internal buffer via a call to
- *    read() if the internal buffer is empty.
+ * rio_fill - Refill the internal buffer via read() if it is empty.
+ *    Returns the number of unread bytes in the buffer, 0 on EOF and
+ *    -1 on error.
  */
-/* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+/* $begin rio_fill */
+static ssize_t rio_fill(rio_t *rp)
 {
-    int cnt;
-
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
 	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
 			   sizeof(rp->rio_buf));
@@ -807,6 +806,25 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 	else 
 	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
     }
+    return rp->rio_cnt;
+}
+/* $end rio_fill */
+
+/* 
+ * rio_read - This is a wrapper for the Unix read() function that
+ *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
+ *    buffer, where n is the number of bytes requested by the user and
+ *    rio_cnt is the number of unread bytes in the internal buffer. On
+ *    entry, rio_read() refills the internal buffer via a call to
+ *    read() if the internal buffer is empty.
+ */
+/* $begin rio_read */
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    int cnt;
+
+    if ((cnt = rio_fill(rp)) <= 0)
+	return cnt;             /* EOF or error */
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
     cnt = n;          
@@ -855,30 +873,44 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 
 /* 
  * rio_readlineb - Robustly read a text line (buffered)
+ *    Instead of pulling one byte at a time through rio_read, search the
+ *    unread part of the internal buffer for '\n' with memchr (vectorized
+ *    in libc) and copy the whole line segment at once.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
+    ssize_t rc;
+    size_t n, cnt;
+    char *bufp = usrbuf, *nl;
+
+    n = 0;
+    while (n + 1 < maxlen) {
+	if ((rc = rio_fill(rp)) < 0)
+	    return -1;	  /* Error */
+	if (rc == 0) {
+	    if (n == 0)
 		return 0; /* EOF, no data read */
 	    else
 		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+	}
+
+	/* Copy up to and including the first '\n', at most maxlen-1-n bytes */
+	cnt = rp->rio_cnt;
+	if (cnt > maxlen - 1 - n)
+	    cnt = maxlen - 1 - n;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	bufp += cnt;
+	n += cnt;
+	if (nl != NULL)
+	    break;
     }
     *bufp = 0;
-    return n-1;
+    return n;
 }
 /* $end rio_readlineb */
 
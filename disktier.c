@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "disktier.h"
+
+#define DISK_MAGIC 0x4b534944u   /* "DISK" */
+#define DISK_ALIGN 8
+#define DISK_MIN_BUCKETS 4096
+
+/*
+ * 파일 안의 레코드 하나 = 헤더 + key + value
+ * off는 "논리 위치" : 처음부터 지금까지 쓴 바이트 수 (덮어써도 계속 증가)
+ * 실제 파일 위치는 off % capacity, head - capacity 보다 앞이면 이미 덮어써진 것
+ * seq는 캐시가 넘겨준 purge 순번 - 다시 읽을 때 그대로 돌려줌
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t key_len;
+    uint64_t size;
+    uint64_t hash;
+    uint64_t off;
+    uint64_t seq;
+} drec_t;
+
+/* 메모리 index 항목 */
+typedef struct dent {
+    uint64_t hash;
+    uint64_t off;
+    uint64_t size;
+    uint32_t key_len;
+    struct dent *next;
+} dent_t;
+
+/* ------------ global var ------------ */
+static int disk_fd = -1;
+static uint64_t disk_cap;
+static uint64_t disk_head;             /* 다음에 쓸 논리 위치 (예약 기준) */
+static dent_t **disk_index;
+static size_t disk_nbuckets, disk_sweep;
+static long disk_hits, disk_misses, disk_writes, disk_entries;
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ------------ routine ------------ */
+/* FNV-1a 64 */
+static uint64_t disk_hash(const char *key, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  while (len--)
+    h = (h ^ (unsigned char)*key++) * 0x100000001b3ULL;
+  return h;
+}
+
+/* off에서 시작하는 레코드가 아직 덮어써지지 않았는지 - disk_lock 잡고 호출 */
+static int disk_live(uint64_t off) {
+  return disk_head <= disk_cap || off >= disk_head - disk_cap;
+}
+
+/* 덮어써진 항목을 bucket 하나씩 치움 - put마다 조금씩 해서 index가 끝없이 커지지 않도록 */
+static void disk_sweep_one(void) {
+  dent_t **pp = &disk_index[disk_sweep], *e;
+  disk_sweep = (disk_sweep + 1) % disk_nbuckets;
+  while ((e = *pp) != NULL) {
+    if (!disk_live(e->off)) {
+      *pp = e->next;
+      free(e);
+      disk_entries--;
+    }
+    else
+      pp = &e->next;
+  }
+}
+
+/*
+ * path 파일을 capacity 바이트짜리 순환 log로 사용
+ * 시작할 때마다 비운다 (index가 메모리에만 있으므로)
+ */
+int disk_init(const char *path, size_t capacity) {
+  if (capacity < 4096)
+    return -1;
+  if ((disk_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+    return -1;
+  if (ftruncate(disk_fd, capacity) < 0) { /* sparse file - 실제 블록은 쓸 때 할당 */
+    close(disk_fd);
+    disk_fd = -1;
+    return -1;
+  }
+  disk_cap = capacity;
+  disk_nbuckets = capacity / 65536 > DISK_MIN_BUCKETS ? capacity / 65536 : DISK_MIN_BUCKETS;
+  disk_index = calloc(disk_nbuckets, sizeof(dent_t *));
+  return 0;
+}
+
+int disk_enabled(void) {
+  return disk_fd >= 0;
+}
+
+/*
+ * 레코드 하나 추가 (메모리 캐시의 eviction 후, 락 밖에서 호출)
+ * 자리 예약만 lock 안에서 하고 pwritev는 lock 없이 -> 다른 스레드의 get/put을 막지 않음
+ * 다 쓴 다음에 index에 올려서 get이 반쯤 쓴 레코드를 보지 않도록 한다.
+ */
+void disk_put(const char *key, const char *value, size_t size, unsigned long seq) {
+  drec_t rec;
+  struct iovec iov[3];
+  size_t key_len = strlen(key);
+  uint64_t len = (sizeof(rec) + key_len + size + DISK_ALIGN - 1) & ~(uint64_t)(DISK_ALIGN - 1);
+  uint64_t h = disk_hash(key, key_len), b;
+  dent_t *e;
+
+  if (disk_fd < 0 || len > disk_cap)
+    return;
+
+  pthread_mutex_lock(&disk_lock);
+  /* 레코드가 파일 끝을 넘어가면 다음 바퀴 처음으로 */
+  if (disk_head % disk_cap + len > disk_cap)
+    disk_head += disk_cap - disk_head % disk_cap;
+  rec.off = disk_head;
+  disk_head += len;
+  pthread_mutex_unlock(&disk_lock);
+
+  rec.magic = DISK_MAGIC;
+  rec.key_len = key_len;
+  rec.size = size;
+  rec.hash = h;
+  rec.seq = seq;
+  iov[0].iov_base = &rec;
+  iov[0].iov_len = sizeof(rec);
+  iov[1].iov_base = (void *)key;
+  iov[1].iov_len = key_len;
+  iov[2].iov_base = (void *)value;
+  iov[2].iov_len = size;
+  if (pwritev(disk_fd, iov, 3, rec.off % disk_cap) != (ssize_t)(sizeof(rec) + key_len + size))
+    return;
+
+  pthread_mutex_lock(&disk_lock);
+  b = h % disk_nbuckets;
+  for (e = disk_index[b]; e != NULL && e->hash != h; e = e->next)
+    ;
+  if (e == NULL && (e = malloc(sizeof(dent_t))) != NULL) {
+    e->hash = h;
+    e->off = rec.off;
+    e->next = disk_index[b];
+    disk_index[b] = e;
+    disk_entries++;
+  }
+  /* 같은 key를 여러 스레드가 동시에 쓰면 나중 위치가 이김 */
+  if (e != NULL && (!disk_live(e->off) || e->off <= rec.off)) {
+    e->off = rec.off;
+    e->size = size;
+    e->key_len = key_len;
+  }
+  disk_writes++;
+  disk_sweep_one();
+  pthread_mutex_unlock(&disk_lock);
+}
+
+/*
+ * key의 value를 value 버퍼(max 바이트)로 읽어옴, *seq에 disk_put 때 받은 순번
+ * 리턴값 : 읽은 바이트 수, 없으면 0
+ * 읽는 도중 다른 put이 그 자리를 덮어쓸 수 있으므로 읽은 뒤에 한 번 더 확인한다.
+ */
+size_t disk_get(const char *key, char *value, size_t max, unsigned long *seq) {
+  drec_t rec;
+  struct iovec iov[3];
+  size_t key_len = strlen(key);
+  uint64_t h = disk_hash(key, key_len), off = 0, size = 0;
+  dent_t *e;
+  char *kbuf = NULL;
+  int ok = 0;
+
+  if (disk_fd < 0)
+    return 0;
+
+  pthread_mutex_lock(&disk_lock);
+  for (e = disk_index[h % disk_nbuckets]; e != NULL && e->hash != h; e = e->next)
+    ;
+  if (e != NULL && disk_live(e->off) && e->key_len == key_len && e->size <= max) {
+    off = e->off;
+    size = e->size;
+    ok = 1;
+  }
+  pthread_mutex_unlock(&disk_lock);
+
+  if (ok && (kbuf = malloc(key_len)) != NULL) {
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof(rec);
+    iov[1].iov_base = kbuf;
+    iov[1].iov_len = key_len;
+    iov[2].iov_base = value;
+    iov[2].iov_len = size;
+    ok = preadv(disk_fd, iov, 3, off % disk_cap) == (ssize_t)(sizeof(rec) + key_len + size)
+      && rec.magic == DISK_MAGIC && rec.off == off && rec.size == size
+      && memcmp(kbuf, key, key_len) == 0;
+  }
+  else
+    ok = 0;
+  free(kbuf);
+
+  pthread_mutex_lock(&disk_lock);
+  ok = ok && disk_live(off);
+  if (ok)
+    disk_hits++;
+  else
+    disk_misses++;
+  pthread_mutex_unlock(&disk_lock);
+  if (ok)
+    *seq = rec.seq;
+  return ok ? size : 0;
+}
+
+/*
+ * 지금까지 쓴 레코드를 전부 무효로 (캐시 purge 규칙이 너무 많아졌을 때)
+ * 쓰는 위치를 한 바퀴 앞으로 옮기기만 하면 disk_live가 예전 레코드를 모두 덮어써진 것으로 본다.
+ * 파일에서 쓰는 자리는 그대로라 아직 쓰고 있는 disk_put과 겹치지 않음 - index는 disk_sweep_one이 치움
+ */
+void disk_clear(void) {
+  if (disk_fd < 0)
+    return;
+  pthread_mutex_lock(&disk_lock);
+  disk_head += disk_cap;
+  pthread_mutex_unlock(&disk_lock);
+}
+
+void disk_stats(disk_stats_t *st) {
+  pthread_mutex_lock(&disk_lock);
+  st->hits = disk_hits;
+  st->misses = disk_misses;
+  st->writes = disk_writes;
+  st->entries = disk_entries;
+  st->capacity = disk_cap;
+  pthread_mutex_unlock(&disk_lock);
+}
@@ -0,0 +1,28 @@
+#ifndef __DISKTIER_H__
+#define __DISKTIER_H__
+
+#include <stddef.h>
+
+/*
+ * 디스크 2차 캐시
+ * 메모리 캐시에서 쫓겨난 노드를 파일 하나에 log 형식으로 이어 쓰고 (끝에 닿으면 처음부터 덮어씀),
+ * key hash -> 파일 위치 index는 메모리에 둔다. 메모리 miss면 여기서 pread로 찾아본다.
+ */
+
+/* 통계용 스냅샷 */
+typedef struct disk_stats {
+    long hits;            /* disk_get 성공 */
+    long misses;          /* disk_get 실패 (index에 없거나 이미 덮어써짐) */
+    long writes;          /* disk_put으로 쓴 레코드 수 */
+    long entries;         /* index 항목 수 (아직 안 치운 덮어써진 항목 포함) */
+    size_t capacity;      /* 파일 크기 */
+} disk_stats_t;
+
+int    disk_init(const char *path, size_t capacity);
+int    disk_enabled(void);
+void   disk_put(const char *key, const char *value, size_t size, unsigned long seq);
+size_t disk_get(const char *key, char *value, size_t max, unsigned long *seq);
+void   disk_clear(void);
+void   disk_stats(disk_stats_t *st);
+
+#endif
@@ -0,0 +1,497 @@
+/*
+ * < loadgen.c >
+ * proxy / tiny 부하 발생기
+ *
+ * closed-loop : 연결(스레드) c개가 응답을 받자마자 다음 요청을 보냄 -> 최대 처리량
+ * open-loop   : 초당 r개 요청을 정해진 시각에 보냄 (-r) -> 주어진 부하에서의 지연 시간
+ *               지연 시간은 "실제로 보낸 시각"이 아니라 "보냈어야 할 시각"부터 잰다.
+ *               서버가 밀려서 요청이 늦게 나가도 그 대기 시간까지 포함 (coordinated omission 방지)
+ *
+ * URL은 -u 파일(한 줄에 하나) or -U 패턴(%d) + -n 개수로 주고,
+ * 순위 기반 Zipf 분포(-z s)로 골라서 캐시 hit 비율을 조절한다. (s = 0 이면 균등)
+ *
+ * replay      : proxy access log(-l)를 trace로 받아(-T) 기록된 시각 간격 그대로 다시 보냄
+ *               -s 배속 (2 = 두 배 빠르게, 0 = 간격 무시하고 closed-loop로 최대한 빨리)
+ *               -O host:port 로 기록된 origin 대신 테스트용 서버로 보낼 수 있다.
+ */
+#include "csapp.h"
+#include "trace.h"
+
+/* 지연 시간 히스토그램 : 2의 거듭제곱 구간마다 16칸 (상대 오차 ~6%) */
+#define LG_SUB_BITS 4
+#define LG_SUB (1 << LG_SUB_BITS)
+#define LG_OCTAVES 34
+#define LG_BUCKETS (LG_SUB + LG_OCTAVES * LG_SUB)
+
+#define MAX_URLS 1000000
+
+typedef struct
+{
+  char host[256];
+  char port[8];
+  char *path;
+  char *request; /* 미리 만들어 둔 요청 메세지 */
+  size_t request_len;
+} url_t;
+
+/* 스레드(연결) 하나의 결과 */
+typedef struct
+{
+  pthread_t tid;
+  int id;
+  unsigned long rng;
+  long requests, errors, timeouts, non2xx;
+  long bytes;
+  long hist[LG_BUCKETS]; /* usec */
+} worker_t;
+
+/* ------------ global var ------------ */
+static url_t *urls;
+static int nurls;
+static double *zipf_cdf;
+static int nconns = 4;
+static double duration = 10.0;
+static double rate = 0;  /* 0 = closed-loop */
+static int keepalive = 0;
+static int timeout_sec = 5;
+static char *proxy_host = NULL, *proxy_port = NULL;
+static char *origin_host = NULL, *origin_port = NULL; /* -O */
+static long start_ns, end_ns;
+
+/* replay 모드 - urls[i]가 trace의 i번째 요청, 스레드들이 next_rec를 하나씩 가져감 */
+static trace_rec_t *trace;
+static long ntrace, next_rec;
+static double speed = 1.0;
+
+/* ------------ routine ------------ */
+static long now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void sleep_until(long ns)
+{
+  struct timespec ts = {ns / 1000000000L, ns % 1000000000L};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+/* xorshift64* - 스레드마다 따로 쓰는 난수 */
+static double rand01(unsigned long *s)
+{
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return ((*s * 2685821657736338717UL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int hist_index(long v)
+{
+  int e;
+  if (v < LG_SUB)
+    return v < 0 ? 0 : v;
+  e = 63 - __builtin_clzl(v);
+  if (e - LG_SUB_BITS >= LG_OCTAVES)
+    return LG_BUCKETS - 1;
+  return LG_SUB + (e - LG_SUB_BITS) * LG_SUB + ((v >> (e - LG_SUB_BITS)) & (LG_SUB - 1));
+}
+
+static long hist_upper(int i)
+{
+  int e, sub;
+  if (i < LG_SUB)
+    return i;
+  e = (i - LG_SUB) / LG_SUB + LG_SUB_BITS;
+  sub = (i - LG_SUB) % LG_SUB;
+  return ((long)(LG_SUB + sub + 1) << (e - LG_SUB_BITS)) - 1;
+}
+
+/* 히스토그램에서 p 백분위 값 */
+static long hist_percentile(long *hist, long total, double p)
+{
+  long cum = 0, want = (long)(total * p / 100.0 + 0.5);
+  int i;
+  if (want < 1)
+    want = 1;
+  for (i = 0; i < LG_BUCKETS; i++)
+  {
+    cum += hist[i];
+    if (cum >= want)
+      return hist_upper(i);
+  }
+  return hist_upper(LG_BUCKETS - 1);
+}
+
+/*
+ * http://host[:port]/path -> url_t
+ * proxy를 거치면 absolute-form, 아니면 origin-form으로 요청을 만들어 둔다.
+ */
+static int add_url(const char *s)
+{
+  url_t *u;
+  const char *p = s, *slash, *colon;
+  char buf[MAXLINE];
+
+  if (nurls >= MAX_URLS + ntrace)
+    return -1;
+  u = &urls[nurls];
+  if (strncasecmp(p, "http://", 7) == 0)
+    p += 7;
+  if ((slash = strchr(p, '/')) == NULL)
+    slash = p + strlen(p);
+  colon = memchr(p, ':', slash - p);
+  if ((colon ? colon : slash) - p >= (long)sizeof(u->host))
+    return -1;
+  snprintf(u->host, sizeof(u->host), "%.*s", (int)((colon ? colon : slash) - p), p);
+  snprintf(u->port, sizeof(u->port), "%.*s", colon ? (int)(slash - colon - 1) : 2, colon ? colon + 1 : "80");
+  u->path = strdup(*slash ? slash : "/");
+  if (origin_host != NULL)
+  {
+    snprintf(u->host, sizeof(u->host), "%s", origin_host);
+    snprintf(u->port, sizeof(u->port), "%s", origin_port);
+  }
+
+  if (proxy_host != NULL)
+    snprintf(buf, sizeof(buf), "GET http://%s:%s%s HTTP/1.1\r\n", u->host, u->port, u->path);
+  else
+    snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\n", u->path);
+  snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+           "Host: %s:%s\r\nUser-Agent: loadgen\r\nConnection: %s\r\n\r\n",
+           u->host, u->port, keepalive ? "keep-alive" : "close");
+  u->request = strdup(buf);
+  u->request_len = strlen(buf);
+  nurls++;
+  return 0;
+}
+
+/* 순위 i(0부터)가 뽑힐 확률 ∝ 1/(i+1)^s 의 누적 분포 */
+static void build_zipf(double s)
+{
+  double sum = 0;
+  int i;
+  zipf_cdf = Malloc(nurls * sizeof(double));
+  for (i = 0; i < nurls; i++)
+    zipf_cdf[i] = (sum += 1.0 / pow(i + 1, s));
+  for (i = 0; i < nurls; i++)
+    zipf_cdf[i] /= sum;
+}
+
+static url_t *pick_url(worker_t *w)
+{
+  double x = rand01(&w->rng);
+  int lo = 0, hi = nurls - 1, mid;
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (zipf_cdf[mid] < x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return &urls[lo];
+}
+
+static int connect_to(url_t *u)
+{
+  struct timeval tv = {timeout_sec, 0};
+  int fd = open_clientfd(proxy_host ? proxy_host : u->host, proxy_host ? proxy_port : u->port);
+  if (fd >= 0)
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return fd;
+}
+
+/*
+ * 요청 하나 보내고 응답을 끝까지 읽음
+ * *fdp : keep-alive면 다음 요청에 다시 쓸 연결, 닫았으면 -1
+ * 리턴값 : 상태 코드, 에러 -1, 타임아웃 -2
+ */
+static int do_request(worker_t *w, url_t *u, int *fdp, rio_t *rio)
+{
+  char line[MAXLINE], sink[MAXBUF], *p;
+  long content_length = -1, n, left;
+  int status = 0, closes = !keepalive, reused = *fdp >= 0;
+
+  if (u->request_len == 0)
+    return -1; /* trace에서 읽지 못한 URL */
+retry:
+  if (*fdp < 0)
+  {
+    if ((*fdp = connect_to(u)) < 0)
+      return -1;
+    rio_readinitb(rio, *fdp);
+  }
+  if (rio_writen(*fdp, u->request, u->request_len) < 0)
+    goto fail;
+
+  /* status line + 헤더 */
+  while ((n = rio_readlineb(rio, line, MAXLINE)) > 0)
+  {
+    w->bytes += n;
+    if (status == 0)
+      sscanf(line, "%*s %d", &status);
+    else if (strncasecmp(line, "Content-length:", 15) == 0)
+      content_length = atol(line + 15);
+    else if (strncasecmp(line, "Connection:", 11) == 0)
+    {
+      for (p = line + 11; *p == ' '; p++)
+        ;
+      if (strncasecmp(p, "close", 5) == 0)
+        closes = 1;
+    }
+    if (strcmp(line, "\r\n") == 0)
+      break;
+  }
+  if (n == 0 && status == 0 && reused)
+  {
+    /* 서버가 쉬고 있던 keep-alive 연결을 먼저 닫음 - 새 연결로 한 번만 다시 */
+    close(*fdp);
+    *fdp = -1;
+    reused = 0;
+    goto retry;
+  }
+  if (n <= 0)
+    goto fail;
+
+  /* body - Content-length가 없으면 연결이 닫힐 때까지 */
+  left = content_length;
+  while (content_length < 0 || left > 0)
+  {
+    n = (content_length < 0 || left > (long)sizeof(sink)) ? (long)sizeof(sink) : left;
+    if ((n = rio_readnb(rio, sink, n)) < 0)
+      goto fail;
+    if (n == 0)
+    {
+      if (content_length >= 0)
+        goto fail; /* 다 받기 전에 끊김 */
+      closes = 1;
+      break;
+    }
+    w->bytes += n;
+    left -= n;
+  }
+  if (content_length < 0)
+    closes = 1;
+  if (closes)
+  {
+    close(*fdp);
+    *fdp = -1;
+  }
+  return status;
+
+fail:
+  n = (errno == EAGAIN || errno == EWOULDBLOCK) ? -2 : -1;
+  close(*fdp);
+  *fdp = -1;
+  return n;
+}
+
+static void *worker(void *vargp)
+{
+  worker_t *w = vargp;
+  rio_t *rio = Malloc(sizeof(rio_t));
+  long interval = 0, intended, done;
+  int fd = -1, status;
+  long k;
+
+  /* open-loop : 이 스레드는 nconns/rate 초마다 하나씩, 스레드끼리 시작 시각을 엇갈리게 */
+  if (rate > 0)
+    interval = (long)(1e9 * nconns / rate);
+  for (k = 0;; k++)
+  {
+    if (trace != NULL)
+    {
+      /* replay : 다음 레코드를 기록된 시각(배속 적용)에 보냄 */
+      if ((k = __sync_fetch_and_add(&next_rec, 1)) >= ntrace)
+        break;
+      if (speed > 0)
+      {
+        intended = start_ns + (long)((trace[k].ts_usec - trace[0].ts_usec) * 1000 / speed);
+        if (intended >= end_ns)
+          break;
+        sleep_until(intended);
+      }
+      else if ((intended = now_ns()) >= end_ns)
+        break;
+    }
+    else if (rate > 0)
+    {
+      intended = start_ns + w->id * interval / nconns + k * interval;
+      if (intended >= end_ns)
+        break;
+      sleep_until(intended); /* 이미 지났으면 바로 리턴 -> 밀린 요청을 몰아서 보냄 */
+    }
+    else if ((intended = now_ns()) >= end_ns)
+      break;
+
+    status = do_request(w, trace ? &urls[k] : pick_url(w), &fd, rio);
+    done = now_ns();
+    w->requests++;
+    if (status == -1)
+      w->errors++;
+    else if (status == -2)
+      w->timeouts++;
+    else if (status < 200 || status > 299)
+      w->non2xx++;
+    w->hist[hist_index((done - intended) / 1000)]++;
+  }
+  if (fd >= 0)
+    close(fd);
+  free(rio);
+  return NULL;
+}
+
+static void usage(char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-c conns] [-d secs] [-r rate] [-k] [-z zipf_s] [-t timeout]\n"
+          "          [-x proxy_host:port] (-u url_file | -U url_pattern -n count | url ...)\n"
+          "       %s [-c conns] [-d secs] [-k] [-t timeout] [-x proxy_host:port]\n"
+          "          -T trace [-s speed] [-O origin_host:port]\n"
+          "  -c  concurrent connections (threads), default 4\n"
+          "  -d  test duration in seconds, default 10\n"
+          "  -r  open-loop arrival rate (req/s, all threads); default closed-loop\n"
+          "  -k  keep connections alive when the server allows it\n"
+          "  -z  Zipf exponent over URL rank (0 = uniform), default 0\n"
+          "  -t  per-request receive timeout in seconds, default 5\n"
+          "  -x  send absolute-form requests through this proxy\n"
+          "  -U  printf pattern with one %%d, expanded for 0..count-1\n"
+          "  -T  replay a proxy access log (-l output) in recorded order and timing\n"
+          "  -s  replay speed factor (2 = twice as fast, 0 = back-to-back), default 1\n"
+          "  -O  send replayed requests to this origin instead of the recorded one\n"
+          "      (with -T, -d only caps the run; default is the whole trace)\n",
+          prog, prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int opt, i, n = 0, duration_set = 0;
+  double zipf_s = 0;
+  char *url_file = NULL, *pattern = NULL, *trace_file = NULL, line[MAXLINE], *p;
+  FILE *fp;
+  worker_t *workers;
+  long hist[LG_BUCKETS] = {0}, requests = 0, errors = 0, timeouts = 0, non2xx = 0, bytes = 0;
+  double elapsed;
+
+  while ((opt = getopt(argc, argv, "c:d:r:kz:t:x:u:U:n:T:s:O:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'c': nconns = atoi(optarg); break;
+    case 'd': duration = atof(optarg); duration_set = 1; break;
+    case 'r': rate = atof(optarg); break;
+    case 'k': keepalive = 1; break;
+    case 'z': zipf_s = atof(optarg); break;
+    case 't': timeout_sec = atoi(optarg); break;
+    case 'x':
+      proxy_host = strdup(optarg);
+      if ((p = strrchr(proxy_host, ':')) == NULL)
+        usage(argv[0]);
+      *p = '\0';
+      proxy_port = p + 1;
+      break;
+    case 'u': url_file = optarg; break;
+    case 'U': pattern = optarg; break;
+    case 'n': n = atoi(optarg); break;
+    case 'T': trace_file = optarg; break;
+    case 's': speed = atof(optarg); break;
+    case 'O':
+      origin_host = strdup(optarg);
+      if ((p = strrchr(origin_host, ':')) == NULL)
+        usage(argv[0]);
+      *p = '\0';
+      origin_port = p + 1;
+      break;
+    default: usage(argv[0]);
+    }
+  }
+  if (nconns <= 0 || duration <= 0 || speed < 0)
+    usage(argv[0]);
+
+  if (trace_file != NULL)
+  {
+    if ((ntrace = trace_load(trace_file, &trace)) < 0)
+      unix_error("open trace file");
+    if (ntrace == 0)
+      app_error("trace has no requests");
+    if (!duration_set)
+      duration = 1e9; /* trace 끝까지 */
+  }
+
+  /* URL 목록 - 순서가 곧 Zipf 순위 (앞쪽일수록 자주) */
+  urls = Calloc(MAX_URLS + ntrace, sizeof(url_t));
+  for (i = 0; i < ntrace; i++)
+    if (add_url(trace[i].url) < 0)
+    {
+      /* 파싱 못 한 URL도 자리는 채워 둬야 urls[k] == trace[k] */
+      urls[nurls].request = "";
+      nurls++;
+    }
+  if (url_file != NULL)
+  {
+    if ((fp = fopen(url_file, "r")) == NULL)
+      unix_error("open url file");
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (line[0] != '\0' && line[0] != '#')
+        add_url(line);
+    }
+    fclose(fp);
+  }
+  if (pattern != NULL)
+    for (i = 0; i < n; i++)
+    {
+      snprintf(line, sizeof(line), pattern, i);
+      add_url(line);
+    }
+  for (i = optind; i < argc; i++)
+    add_url(argv[i]);
+  if (nurls == 0)
+    usage(argv[0]);
+  build_zipf(zipf_s);
+  Signal(SIGPIPE, SIG_IGN);
+
+  workers = Calloc(nconns, sizeof(worker_t));
+  start_ns = now_ns();
+  end_ns = start_ns + (long)(duration * 1e9);
+  for (i = 0; i < nconns; i++)
+  {
+    workers[i].id = i;
+    workers[i].rng = 0x9E3779B97F4A7C15UL * (i + 1);
+    Pthread_create(&workers[i].tid, NULL, worker, &workers[i]);
+  }
+  for (i = 0; i < nconns; i++)
+  {
+    Pthread_join(workers[i].tid, NULL);
+    requests += workers[i].requests;
+    errors += workers[i].errors;
+    timeouts += workers[i].timeouts;
+    non2xx += workers[i].non2xx;
+    bytes += workers[i].bytes;
+    for (n = 0; n < LG_BUCKETS; n++)
+      hist[n] += workers[i].hist[n];
+  }
+  elapsed = (now_ns() - start_ns) / 1e9;
+
+  if (trace != NULL)
+    printf("mode: replay, conns: %d, trace: %ld requests over %.2f s, speed: %.2f%s\n",
+           nconns, ntrace, (trace[ntrace - 1].ts_usec - trace[0].ts_usec) / 1e6, speed,
+           keepalive ? ", keep-alive" : "");
+  else
+    printf("mode: %s, conns: %d, urls: %d, zipf: %.2f%s\n",
+           rate > 0 ? "open-loop" : "closed-loop", nconns, nurls, zipf_s, keepalive ? ", keep-alive" : "");
+  if (rate > 0 && trace == NULL)
+    printf("target rate: %.1f req/s\n", rate);
+  printf("requests: %ld  errors: %ld  timeouts: %ld  non-2xx: %ld\n", requests, errors, timeouts, non2xx);
+  printf("duration: %.2f s  throughput: %.1f req/s  %.2f MB/s\n",
+         elapsed, requests / elapsed, bytes / elapsed / 1e6);
+  if (requests > 0)
+    printf("latency usec: p50 %ld  p90 %ld  p99 %ld  p99.9 %ld  max %ld\n",
+           hist_percentile(hist, requests, 50), hist_percentile(hist, requests, 90),
+           hist_percentile(hist, requests, 99), hist_percentile(hist, requests, 99.9),
+           hist_percentile(hist, requests, 100));
+  return 0;
+}
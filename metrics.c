@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "metrics.h"
+#include "cache.h"
+#include "accesslog.h"
+#include "disktier.h"
+#include "snapshot.h"
+#include "compress.h"
+#include "prefetch.h"
+#include "upstream.h"
+#include "cmem.h"
+
+/*
+ * HDR 스타일 log-linear 히스토그램
+ * 2의 거듭제곱 구간 하나를 HIST_SUB 칸으로 나눔 -> 어느 크기에서나 상대 오차 1/HIST_SUB 정도
+ * 0 ~ 3us 는 1us 단위, 이후 2^28us(약 268초)까지
+ */
+#define HIST_SUB_BITS 2
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_OCTAVES  27
+#define HIST_BUCKETS  (HIST_SUB + HIST_OCTAVES * HIST_SUB)
+#define HIST_OVERFLOW HIST_BUCKETS  /* 마지막 le보다 큰 값 - +Inf에만 셈 */
+
+/* slot 하나의 통계 - 쓰는 스레드가 하나뿐이라 원자적 RMW 없이 load/store만 */
+typedef struct {
+    atomic_long counters[M_NCOUNTERS];
+    atomic_long hist[M_NHISTS][HIST_BUCKETS + 1];
+    atomic_long hist_sum[M_NHISTS];
+} mslot_t;
+
+static const char *counter_name[M_NCOUNTERS] = {
+    "proxy_requests_total", "proxy_cache_hits_total", "proxy_cache_misses_total",
+    "proxy_bad_requests_total", "proxy_origin_errors_total",
+    "proxy_bytes_from_cache_total", "proxy_bytes_from_origin_total",
+    "proxy_peer_requests_total", "proxy_peer_failures_total", "proxy_negative_hits_total"};
+static const char *hist_name[M_NHISTS] = {
+    "proxy_request_latency_seconds", "proxy_upstream_connect_seconds", "proxy_upstream_ttfb_seconds"};
+
+/* ------------ global var ------------ */
+static int m_nslots;
+static _Atomic(mslot_t *) *m_slots;  /* slot 별 통계, 처음 쓸 때 할당 */
+
+/* ------------ routine ------------ */
+void metrics_init(int nslots) {
+  m_nslots = nslots;
+  m_slots = calloc(nslots, sizeof(*m_slots));
+}
+
+/* slot 주인 스레드만 부름 */
+static mslot_t *mslot(int slot) {
+  mslot_t *m;
+  if (m_slots == NULL || slot < 0 || slot >= m_nslots)
+    return NULL;
+  if ((m = atomic_load_explicit(&m_slots[slot], memory_order_acquire)) == NULL) {
+    if ((m = calloc(1, sizeof(mslot_t))) == NULL)
+      return NULL;
+    atomic_store_explicit(&m_slots[slot], m, memory_order_release);
+  }
+  return m;
+}
+
+/* 단일 writer용 증가 - lock 접두사 붙는 fetch_add 대신 */
+static inline void inc(atomic_long *c, long v) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+void metrics_add(int slot, int counter, long v) {
+  mslot_t *m = mslot(slot);
+  if (m != NULL)
+    inc(&m->counters[counter], v);
+}
+
+/* usec 값이 들어갈 bucket 번호 */
+static int hist_index(long v) {
+  int e;
+  if (v < HIST_SUB)
+    return v < 0 ? 0 : v;
+  e = 63 - __builtin_clzl(v); /* v의 최상위 비트 위치 (>= HIST_SUB_BITS) */
+  if (e - HIST_SUB_BITS >= HIST_OCTAVES)
+    return HIST_OVERFLOW;
+  return HIST_SUB + (e - HIST_SUB_BITS) * HIST_SUB + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* bucket i에 들어가는 가장 큰 값 (usec) */
+static long hist_upper(int i) {
+  int e, sub;
+  if (i < HIST_SUB)
+    return i;
+  e = (i - HIST_SUB) / HIST_SUB + HIST_SUB_BITS;
+  sub = (i - HIST_SUB) % HIST_SUB;
+  return ((long)(HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void metrics_observe(int slot, int hist, long usec) {
+  mslot_t *m = mslot(slot);
+  if (m == NULL || usec < 0)
+    return;
+  inc(&m->hist[hist][hist_index(usec)], 1);
+  inc(&m->hist_sum[hist], usec);
+}
+
+/*
+ * 모든 slot을 합쳐 Prometheus text exposition 형식으로
+ * 리턴값 : malloc된 문자열 (부른 쪽에서 free), *len에 길이
+ */
+char *metrics_render(size_t *len) {
+  long counters[M_NCOUNTERS] = {0}, sum[M_NHISTS] = {0}, cum;
+  static long buckets[M_NHISTS][HIST_BUCKETS + 1];
+  static pthread_mutex_t busy = PTHREAD_MUTEX_INITIALIZER;
+  cache_stats_t cst;
+  disk_stats_t dst;
+  snap_stats_t sst;
+  compress_stats_t zst;
+  prefetch_stats_t pst;
+  mslot_t *m;
+  char *buf = NULL;
+  FILE *f;
+  int i, j, k;
+
+  /* buckets가 커서 static - 동시에 여러 scrape가 오면 순서대로 */
+  pthread_mutex_lock(&busy);
+  memset(buckets, 0, sizeof(buckets));
+  for (i = 0; i < m_nslots; i++) {
+    if ((m = atomic_load_explicit(&m_slots[i], memory_order_acquire)) == NULL)
+      continue;
+    for (j = 0; j < M_NCOUNTERS; j++)
+      counters[j] += atomic_load_explicit(&m->counters[j], memory_order_relaxed);
+    for (j = 0; j < M_NHISTS; j++) {
+      sum[j] += atomic_load_explicit(&m->hist_sum[j], memory_order_relaxed);
+      for (k = 0; k <= HIST_BUCKETS; k++)
+        buckets[j][k] += atomic_load_explicit(&m->hist[j][k], memory_order_relaxed);
+    }
+  }
+
+  if ((f = open_memstream(&buf, len)) == NULL) {
+    pthread_mutex_unlock(&busy);
+    return NULL;
+  }
+  for (j = 0; j < M_NCOUNTERS; j++)
+    fprintf(f, "# TYPE %s counter\n%s %ld\n", counter_name[j], counter_name[j], counters[j]);
+
+  cache_stats(&cst);
+  fprintf(f, "# TYPE proxy_cache_evictions_total counter\nproxy_cache_evictions_total %ld\n", cst.evictions);
+  fprintf(f, "# TYPE proxy_cache_sync_evictions_total counter\nproxy_cache_sync_evictions_total %ld\n",
+          cst.sync_evictions);
+  fprintf(f, "# TYPE proxy_cache_purged_total counter\nproxy_cache_purged_total %ld\n", cst.purged);
+  fprintf(f, "# TYPE proxy_cache_bytes gauge\nproxy_cache_bytes %zu\n", cst.size);
+  fprintf(f, "# TYPE proxy_cache_entries gauge\nproxy_cache_entries %ld\n", cst.entries);
+  fprintf(f, "# TYPE proxy_cache_numa_hits_total counter\n"
+             "proxy_cache_numa_hits_total{locality=\"local\"} %ld\n"
+             "proxy_cache_numa_hits_total{locality=\"remote\"} %ld\n", cst.hits_local, cst.hits_remote);
+  fprintf(f, "# TYPE proxy_cache_l1_hits_total counter\nproxy_cache_l1_hits_total %ld\n", cst.hits_l1);
+  fprintf(f, "# TYPE proxy_cache_arena_bytes gauge\n");
+  for (j = 0; j < cmem_nodes(); j++)
+    fprintf(f, "proxy_cache_arena_bytes{node=\"%d\"} %zu\n", j, cmem_mapped(j));
+  fprintf(f, "# TYPE proxy_access_log_dropped_total counter\nproxy_access_log_dropped_total %ld\n",
+          alog_dropped_count());
+  if (disk_enabled()) {
+    disk_stats(&dst);
+    fprintf(f, "# TYPE proxy_disk_hits_total counter\nproxy_disk_hits_total %ld\n", dst.hits);
+    fprintf(f, "# TYPE proxy_disk_misses_total counter\nproxy_disk_misses_total %ld\n", dst.misses);
+    fprintf(f, "# TYPE proxy_disk_writes_total counter\nproxy_disk_writes_total %ld\n", dst.writes);
+    fprintf(f, "# TYPE proxy_disk_entries gauge\nproxy_disk_entries %ld\n", dst.entries);
+    fprintf(f, "# TYPE proxy_disk_capacity_bytes gauge\nproxy_disk_capacity_bytes %zu\n", dst.capacity);
+  }
+  if (snap_enabled()) {
+    snap_stats(&sst);
+    fprintf(f, "# TYPE proxy_snapshot_loaded gauge\nproxy_snapshot_loaded %ld\n", sst.loaded);
+    fprintf(f, "# TYPE proxy_snapshot_hits_total counter\nproxy_snapshot_hits_total %ld\n", sst.hits);
+    fprintf(f, "# TYPE proxy_snapshot_corrupt_total counter\nproxy_snapshot_corrupt_total %ld\n", sst.corrupt);
+    fprintf(f, "# TYPE proxy_snapshot_saves_total counter\nproxy_snapshot_saves_total %ld\n", sst.saves);
+  }
+  if (compress_enabled()) {
+    compress_stats(&zst);
+    fprintf(f, "# TYPE proxy_compress_variants_total counter\nproxy_compress_variants_total %ld\n", zst.variants);
+    fprintf(f, "# TYPE proxy_compress_skipped_total counter\nproxy_compress_skipped_total %ld\n", zst.skipped);
+    fprintf(f, "# TYPE proxy_compress_dropped_total counter\nproxy_compress_dropped_total %ld\n", zst.dropped);
+    fprintf(f, "# TYPE proxy_compress_saved_bytes_total counter\nproxy_compress_saved_bytes_total %ld\n", zst.saved);
+  }
+  if (prefetch_enabled()) {
+    prefetch_stats(&pst);
+    fprintf(f, "# TYPE proxy_prefetch_queued_total counter\nproxy_prefetch_queued_total %ld\n", pst.queued);
+    fprintf(f, "# TYPE proxy_prefetch_fetched_total counter\nproxy_prefetch_fetched_total %ld\n", pst.fetched);
+    fprintf(f, "# TYPE proxy_prefetch_skipped_total counter\nproxy_prefetch_skipped_total %ld\n", pst.skipped);
+    fprintf(f, "# TYPE proxy_prefetch_dropped_total counter\nproxy_prefetch_dropped_total %ld\n", pst.dropped);
+    fprintf(f, "# TYPE proxy_prefetch_bytes_total counter\nproxy_prefetch_bytes_total %ld\n", pst.bytes);
+  }
+  upstream_render(f);
+
+  for (j = 0; j < M_NHISTS; j++) {
+    fprintf(f, "# TYPE %s histogram\n", hist_name[j]);
+    cum = 0;
+    for (k = 0; k < HIST_BUCKETS; k++) {
+      cum += buckets[j][k];
+      fprintf(f, "%s_bucket{le=\"%.6f\"} %ld\n", hist_name[j], hist_upper(k) / 1e6, cum);
+    }
+    cum += buckets[j][HIST_OVERFLOW];
+    fprintf(f, "%s_bucket{le=\"+Inf\"} %ld\n", hist_name[j], cum);
+    fprintf(f, "%s_sum %.6f\n%s_count %ld\n", hist_name[j], sum[j] / 1e6, hist_name[j], cum);
+  }
+  fclose(f);
+  pthread_mutex_unlock(&busy);
+  return buf;
+}
@@ -0,0 +1,41 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+/*
+ * proxy 내부 통계
+ * 연결 slot마다 자기 카운터/히스토그램을 따로 가지고 (쓰는 스레드는 slot 주인 하나뿐),
+ * 읽을 때 모든 slot을 합쳐서 Prometheus text 형식으로 내보낸다. (lock X)
+ */
+
+/* 이 경로로 들어온 요청은 엔드 서버로 보내지 않고 통계를 응답함 */
+#define METRICS_PATH "/__proxy/metrics"
+
+/* 카운터 */
+enum {
+    M_REQUESTS = 0,     /* 처리한 요청 수 */
+    M_HITS,             /* 캐시 hit */
+    M_MISSES,           /* 캐시 miss (엔드 서버로 보냄) */
+    M_BAD_REQUESTS,     /* 400 */
+    M_ORIGIN_ERRORS,    /* 엔드 서버 연결 실패 (DNS, socket) */
+    M_BYTES_CACHE,      /* 캐시에서 보낸 바이트 */
+    M_BYTES_ORIGIN,     /* 엔드 서버에서 받아 보낸 바이트 */
+    M_PEER_REQUESTS,    /* miss를 주인 peer에게 넘긴 요청 */
+    M_PEER_FAILURES,    /* 주인 peer에 연결이 안 돼 엔드 서버로 보낸 요청 */
+    M_NEGATIVE_HITS,    /* 음성 캐시(404/410, DNS 실패)로 답한 요청 */
+    M_NCOUNTERS
+};
+
+/* 지연 시간 히스토그램 (usec) */
+enum {
+    H_LATENCY = 0,      /* 요청 읽기 시작 ~ 응답 끝 */
+    H_CONNECT,          /* 엔드 서버 open_clientfd */
+    H_TTFB,             /* 엔드 서버에 요청 보낸 뒤 첫 응답 줄까지 */
+    M_NHISTS
+};
+
+void metrics_init(int nslots);
+void metrics_add(int slot, int counter, long v);
+void metrics_observe(int slot, int hist, long usec);
+char *metrics_render(size_t *len);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "peer.h"
+#include "csapp.h"
+
+/* ring 위의 점 하나 */
+typedef struct {
+    uint64_t hash;
+    int node;             /* p_nodes 번호, 0은 자기 자신 */
+} rpoint_t;
+
+/* 노드 하나 - "host:port" */
+typedef struct {
+    char *name;
+    char host[MAXLINE];
+    char port[8];
+    atomic_long down_until;  /* 이 시각(초)까지는 건너뜀 */
+} pnode_t;
+
+/* ------------ global var ------------ */
+static pnode_t p_nodes[PEER_MAX];
+static int p_count = 1;               /* p_nodes[0] = 자기 자신 */
+static rpoint_t *p_ring;              /* hash 순으로 정렬, peer_init 뒤로는 읽기만 */
+static int p_points;
+
+/* ------------ routine ------------ */
+/* FNV-1a 64 + 마지막에 비트를 섞어서 비슷한 문자열도 ring 위에 고르게 */
+static uint64_t peer_hash(const char *s) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static int point_cmp(const void *a, const void *b) {
+  uint64_t x = ((const rpoint_t *)a)->hash, y = ((const rpoint_t *)b)->hash;
+  return x < y ? -1 : x > y;
+}
+
+/* "host:port" 를 p_nodes[i]에 */
+static int node_set(int i, const char *name) {
+  const char *colon = strrchr(name, ':');
+
+  if (colon == NULL || colon == name || (size_t)(colon - name) >= MAXLINE || strlen(colon + 1) >= 8)
+    return -1;
+  if ((p_nodes[i].name = strdup(name)) == NULL)
+    return -1;
+  memcpy(p_nodes[i].host, name, colon - name);
+  p_nodes[i].host[colon - name] = '\0';
+  strcpy(p_nodes[i].port, colon + 1);
+  atomic_init(&p_nodes[i].down_until, 0);
+  return 0;
+}
+
+/* peer 하나 추가 (peer_init 전에) - 잘못된 형식이거나 너무 많으면 -1 */
+int peer_add(const char *name) {
+  if (p_count == PEER_MAX || node_set(p_count, name) < 0)
+    return -1;
+  p_count++;
+  return 0;
+}
+
+/*
+ * 자기 이름으로 ring 생성 - 다른 노드가 -p로 부르는 이름과 같아야 한다.
+ * peer 목록에 자기 자신이 들어 있으면 빼므로 모든 노드에 같은 목록을 줘도 됨
+ */
+int peer_init(const char *self) {
+  char vname[MAXLINE + 16];
+  int i, j, n;
+
+  if (node_set(0, self) < 0)
+    return -1;
+  for (i = 1; i < p_count; i++)
+    if (strcmp(p_nodes[i].name, self) == 0) {
+      free(p_nodes[i].name);
+      p_nodes[i] = p_nodes[--p_count];
+      i--;
+    }
+  if (p_count == 1)
+    return 0; /* peer 없음 */
+
+  if ((p_ring = malloc(sizeof(rpoint_t) * p_count * PEER_VNODES)) == NULL)
+    return -1;
+  for (n = 0, i = 0; i < p_count; i++)
+    for (j = 0; j < PEER_VNODES; j++) {
+      snprintf(vname, sizeof(vname), "%s#%d", p_nodes[i].name, j);
+      p_ring[n].hash = peer_hash(vname);
+      p_ring[n].node = i;
+      n++;
+    }
+  qsort(p_ring, n, sizeof(rpoint_t), point_cmp);
+  p_points = n;
+  return 0;
+}
+
+int peer_enabled(void) {
+  return p_points > 0;
+}
+
+const char *peer_name(int peer) {
+  return p_nodes[peer].name;
+}
+
+/*
+ * key의 주인 노드 - 자기 자신이면 -1
+ * key hash 이상인 첫 점부터 시계 방향으로, 지금 건너뛰는 중인 peer는 지나친다.
+ */
+int peer_owner(const char *key) {
+  uint64_t h;
+  long now;
+  int lo, hi, mid, i, node;
+
+  if (p_points == 0)
+    return -1;
+  h = peer_hash(key);
+  lo = 0;
+  hi = p_points;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (p_ring[mid].hash < h)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  now = time(NULL);
+  for (i = 0; i < p_points; i++) {
+    node = p_ring[(lo + i) % p_points].node;
+    if (node == 0)
+      return -1;
+    if (atomic_load_explicit(&p_nodes[node].down_until, memory_order_relaxed) <= now)
+      return node;
+  }
+  return -1;
+}
+
+/* peer에 연결 - 실패하면 PEER_RETRY_SEC 동안 ring에서 건너뛰도록 표시하고 -1 */
+int peer_connect(int peer) {
+  int fd = open_clientfd(p_nodes[peer].host, p_nodes[peer].port);
+  if (fd < 0)
+    atomic_store_explicit(&p_nodes[peer].down_until, (long)time(NULL) + PEER_RETRY_SEC, memory_order_relaxed);
+  return fd;
+}
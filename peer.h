@@ -0,0 +1,26 @@
+#ifndef __PEER_H__
+#define __PEER_H__
+
+/*
+ * consistent-hash 캐시 peering
+ * 모든 proxy 노드(자기 자신 포함)를 가상 노드 PEER_VNODES개씩 hash ring에 올리고,
+ * 캐시 key가 떨어지는 자리의 노드를 주인으로 정한다.
+ * 주인이 자신이면 평소처럼, 아니면 엔드 서버보다 먼저 주인 peer에게 proxy 요청을 보낸다.
+ * 노드마다 같은 이름 목록을 주면 어느 노드에서 보든 주인이 같다.
+ */
+
+#define PEER_MAX 64           /* 자기 자신 포함 최대 노드 수 */
+#define PEER_VNODES 160       /* 노드 하나당 ring 위의 점 개수 */
+#define PEER_RETRY_SEC 5      /* 연결에 실패한 peer는 이 시간 동안 ring에서 건너뜀 */
+
+/* peer가 보낸 요청 표시 - 이 헤더가 있으면 다시 peer로 넘기지 않고 엔드 서버로 (loop 방지) */
+#define PEER_HDR "X-Proxy-Peer"
+
+int         peer_add(const char *name);
+int         peer_init(const char *self);
+int         peer_enabled(void);
+int         peer_owner(const char *key);
+int         peer_connect(int peer);
+const char *peer_name(int peer);
+
+#endif
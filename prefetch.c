@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "prefetch.h"
+#include "cache.h"
+#include "compress.h"
+#include "peer.h"
+#include "upstream.h"
+#include "csapp.h"
+
+/* prefetch 작업 하나 - 받을 객체의 origin과 path (복사본) */
+typedef struct {
+    char *host;
+    int port;
+    char *path;
+} pjob_t;
+
+/* ------------ global var ------------ */
+static int p_enabled;
+static size_t p_budget;               /* bytes/s */
+static pthread_mutex_t p_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t p_ready = PTHREAD_COND_INITIALIZER;
+static pjob_t p_queue[PREFETCH_QUEUE_LEN];
+static int p_head, p_count;           /* p_queue[p_head] 부터 p_count개 */
+static prefetch_stats_t p_stats;
+
+static void *prefetch_worker(void *vargp);
+
+/* ------------ routine ------------ */
+/* prefetch 스레드 시작 - budget : 엔드 서버에서 받는 양의 상한 (bytes/s) */
+int prefetch_init(size_t budget) {
+  pthread_t tid;
+
+  if (budget == 0)
+    return -1;
+  p_budget = budget;
+  if (pthread_create(&tid, NULL, prefetch_worker, NULL) != 0)
+    return -1;
+  pthread_detach(tid);
+  p_enabled = 1;
+  return 0;
+}
+
+int prefetch_enabled(void) {
+  return p_enabled;
+}
+
+/* [p, end)에서 다음 src=, href= 속성 값 - 값 뒤의 위치 리턴, 없으면 NULL */
+static const char *next_link(const char *p, const char *end, const char **val, size_t *vlen) {
+  const char *start = p, *q;
+  size_t n;
+  char quote;
+
+  for (; p < end; p++) {
+    if (end - p > 4 && strncasecmp(p, "src", 3) == 0)
+      n = 3;
+    else if (end - p > 5 && strncasecmp(p, "href", 4) == 0)
+      n = 4;
+    else
+      continue;
+    if (p > start && !isspace((unsigned char)p[-1]))
+      continue; /* data-src, xhref 같은 다른 속성 */
+    for (q = p + n; q < end && isspace((unsigned char)*q); q++)
+      ;
+    if (q == end || *q != '=')
+      continue;
+    for (q++; q < end && isspace((unsigned char)*q); q++)
+      ;
+    if (q < end && (*q == '"' || *q == '\'')) {
+      quote = *q++;
+      *val = q;
+      if ((q = memchr(q, quote, end - q)) == NULL)
+        return NULL;
+    }
+    else {
+      *val = q;
+      while (q < end && !isspace((unsigned char)*q) && *q != '>')
+        q++;
+    }
+    *vlen = q - *val;
+    return q;
+  }
+  return NULL;
+}
+
+/*
+ * 링크 v를 같은 origin (host:port)의 path로 바꿔 out에 - 다른 origin이거나 http가 아니면 -1
+ * base : 링크가 있던 페이지의 path (상대 경로 기준)
+ */
+static int resolve(const char *host, size_t host_len, int port, const char *base, size_t base_len,
+                   const char *v, size_t vlen, char *out, size_t cap) {
+  const char *h, *slash, *colon, *q;
+  size_t n, dir;
+  int lport = 80;
+
+  if ((q = memchr(v, '#', vlen)) != NULL)
+    vlen = q - v; /* fragment는 서버로 가지 않음 */
+  if (vlen >= 2 && v[0] == '/' && v[1] == '/') {
+    v += 2; /* //host/path - 이 페이지와 같은 scheme (http) */
+    vlen -= 2;
+    goto absolute;
+  }
+  if (vlen >= 7 && strncasecmp(v, "http://", 7) == 0) {
+    v += 7;
+    vlen -= 7;
+absolute:
+    h = v;
+    if ((slash = memchr(v, '/', vlen)) == NULL)
+      slash = v + vlen;
+    if ((colon = memchr(h, ':', slash - h)) != NULL)
+      lport = atoi(colon + 1);
+    else
+      colon = slash;
+    if ((size_t)(colon - h) != host_len || strncasecmp(h, host, host_len) != 0 || lport != port)
+      return -1;
+    vlen -= slash - v;
+    v = slash;
+    if (vlen == 0) {
+      v = "/";
+      vlen = 1;
+    }
+  }
+  if (vlen == 0)
+    return -1;
+  /* https:, mailto:, javascript:, data: ... - 첫 '/' 앞에 ':'이 있으면 다른 scheme */
+  for (q = v; q < v + vlen && *q != '/'; q++)
+    if (*q == ':')
+      return -1;
+
+  if (v[0] == '/')
+    dir = 0;
+  else {
+    /* 상대 경로 - base의 query를 떼고 마지막 '/'까지가 디렉터리 */
+    if ((q = memchr(base, '?', base_len)) != NULL)
+      base_len = q - base;
+    for (dir = base_len; dir > 0 && base[dir - 1] != '/'; dir--)
+      ;
+    if (dir == 0)
+      return -1;
+    if (vlen >= 2 && v[0] == '.' && v[1] == '/') {
+      v += 2;
+      vlen -= 2;
+    }
+  }
+  if (dir + vlen >= cap)
+    return -1;
+  memcpy(out, base, dir);
+  memcpy(out + dir, v, vlen);
+  n = dir + vlen;
+  out[n] = '\0';
+  /* 정규화는 하지 않으므로 ..이 들어간 경로와 공백은 포기 (캐시 key가 클라이언트 요청과 달라짐) */
+  if (strstr(out, "..") != NULL)
+    return -1;
+  for (q = out; *q; q++)
+    if (isspace((unsigned char)*q))
+      return -1;
+  return 0;
+}
+
+/* 작업 하나를 대기열에 - 같은 것이 이미 있으면 그냥, 꽉 찼으면 버림 (p_lock 안에서) */
+static void enqueue(const char *host, size_t host_len, int port, const char *path) {
+  pjob_t *job;
+  int i;
+
+  for (i = 0; i < p_count; i++) {
+    job = &p_queue[(p_head + i) % PREFETCH_QUEUE_LEN];
+    if (job->port == port && strcmp(job->path, path) == 0 &&
+        strlen(job->host) == host_len && strncmp(job->host, host, host_len) == 0)
+      return;
+  }
+  if (p_count == PREFETCH_QUEUE_LEN) {
+    p_stats.dropped++;
+    return;
+  }
+  job = &p_queue[(p_head + p_count) % PREFETCH_QUEUE_LEN];
+  job->host = strndup(host, host_len);
+  job->path = strdup(path);
+  job->port = port;
+  if (job->host == NULL || job->path == NULL) {
+    free(job->host);
+    free(job->path);
+    return;
+  }
+  p_count++;
+  p_stats.queued++;
+  pthread_cond_signal(&p_ready);
+}
+
+/*
+ * 캐시에 새로 넣은 응답에서 같은 origin 링크를 뽑아 대기열에 넣고 바로 리턴
+ * 200 text/html 응답만 - host, port, path는 그 응답을 받은 요청
+ */
+void prefetch_submit(const char *host, size_t host_len, int port, const char *path, size_t path_len,
+                     const char *response, size_t len) {
+  const char *p, *end = response + len, *eol, *body = NULL, *v;
+  char link[MAXLINE];
+  size_t vlen;
+  int html = 0, n = 0;
+
+  if (!p_enabled || len < 12 || strncmp(response + 9, "200", 3) != 0)
+    return;
+  for (p = response; p < end; p = eol) {
+    eol = memchr(p, '\n', end - p);
+    eol = eol ? eol + 1 : end;
+    if (eol - p <= 2 && (*p == '\r' || *p == '\n')) {
+      body = eol;
+      break;
+    }
+    if (strncasecmp(p, "Content-type:", 13) == 0) {
+      for (v = p + 13; v < eol && (*v == ' ' || *v == '\t'); v++)
+        ;
+      html = eol - v >= 9 && strncasecmp(v, "text/html", 9) == 0;
+    }
+  }
+  if (body == NULL || !html)
+    return;
+
+  pthread_mutex_lock(&p_lock);
+  for (p = body; n < PREFETCH_MAX_LINKS && (p = next_link(p, end, &v, &vlen)) != NULL; ) {
+    if (resolve(host, host_len, port, path, path_len, v, vlen, link, sizeof(link)) == 0 &&
+        !(strlen(link) == path_len && memcmp(link, path, path_len) == 0)) { /* 자기 자신 */
+      enqueue(host, host_len, port, link);
+      n++;
+    }
+  }
+  pthread_mutex_unlock(&p_lock);
+}
+
+/* 엔드 서버 연결 - -u pool에 있는 host면 그 backend로 */
+static int connect_origin(pjob_t *job, backend_t **backend) {
+  char port_str[8];
+  int pool;
+
+  *backend = NULL;
+  if ((pool = upstream_find(job->host, job->port)) >= 0)
+    return upstream_connect(pool, backend);
+  sprintf(port_str, "%d", job->port);
+  return open_clientfd(job->host, port_str);
+}
+
+/* 응답 헤더를 다 받았으면 헤더 + Content-length 바이트 수 (Content-length가 없으면 0), 아직이면 -1 */
+static long expected_len(const char *buf, size_t len) {
+  const char *p, *eol;
+  long clen = 0;
+
+  for (p = buf; p < buf + len; p = eol + 1) {
+    if ((eol = memchr(p, '\n', buf + len - p)) == NULL)
+      break;
+    if (eol - p <= 1) /* 빈 줄 */
+      return clen > 0 ? (eol + 1 - buf) + clen : 0;
+    if (strncasecmp(p, "Content-length:", 15) == 0)
+      clen = atol(p + 15);
+  }
+  return -1;
+}
+
+/*
+ * 하나 받아서 캐시 - 리턴값 : 엔드 서버에서 받은 바이트 수 (예산에서 뺄 양)
+ * 이미 캐시에 있거나 다른 peer가 주인인 key면 받지 않음
+ */
+static size_t prefetch_job(pjob_t *job, char *buf) {
+  char key[MAXLINE], req[MAXLINE];
+  struct timeval tv = {PREFETCH_TIMEOUT_SEC, 0};
+  backend_t *backend;
+  cobj_t *obj;
+  size_t len = 0, stored = 0;
+  ssize_t n;
+  long expect = -1;
+  int fd, ok = 0;
+
+  if ((size_t)snprintf(key, sizeof(key), "GET http://%s:%d%s", job->host, job->port, job->path) >= sizeof(key))
+    return 0;
+  if ((obj = cache_acquire(key)) != NULL) {
+    cobj_put(obj);
+    goto skip;
+  }
+  if (peer_enabled() && peer_owner(key) >= 0)
+    goto skip;
+
+  if ((fd = connect_origin(job, &backend)) < 0)
+    goto skip;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  n = snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\nHost: %s:%d\r\nConnection: close\r\n\r\n",
+               job->path, job->host, job->port);
+  if (n < (ssize_t)sizeof(req) && rio_writen(fd, req, n) == n) {
+    /* 헤더를 볼 때까지는 조금씩 - 캐시에 안 들어갈 크기면 body를 받지 않고 그만 (예산 낭비) */
+    while (len < PREFETCH_MAX_OBJECT &&
+           (n = read(fd, buf + len, expect < 0 && PREFETCH_MAX_OBJECT - len > MAXLINE ? MAXLINE : PREFETCH_MAX_OBJECT - len)) > 0) {
+      len += n;
+      if (expect < 0 && (expect = expected_len(buf, len)) > PREFETCH_MAX_OBJECT)
+        break;
+    }
+    /* 끝까지 (EOF) 받았고 캐시에 들어가는 크기인 200 응답만 */
+    ok = n == 0 && len > 12 && strncmp(buf, "HTTP/1.", 7) == 0 && strncmp(buf + 9, "200", 3) == 0;
+  }
+  close(fd);
+  if (backend != NULL)
+    upstream_release(backend);
+
+  /* miss 경로로 받은 것과 같은 헤더로 (압축 대상이면 Vary) - 끼울 자리가 없으면 캐시하지 않음 */
+  if (ok && (stored = compress_add_vary(buf, len, PREFETCH_MAX_OBJECT)) == 0)
+    ok = 0;
+  if (ok) {
+    cache_place(key, buf, stored);
+    compress_submit(key, buf, stored);
+  }
+  pthread_mutex_lock(&p_lock);
+  p_stats.bytes += len;
+  if (ok)
+    p_stats.fetched++;
+  else
+    p_stats.skipped++;
+  pthread_mutex_unlock(&p_lock);
+  return len;
+
+skip:
+  pthread_mutex_lock(&p_lock);
+  p_stats.skipped++;
+  pthread_mutex_unlock(&p_lock);
+  return 0;
+}
+
+static long mono_usec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/*
+ * prefetch 스레드 - 대기열에서 하나씩 받아 캐시 (연결 스레드는 기다리지 않음)
+ * 예산 : tokens는 쓸 수 있는 바이트 (최대 1초치), 받은 만큼 빼고 시간이 지나면 budget/s씩 채움
+ *        음수(빚)면 다 갚을 때까지 쉬고 다음 것
+ */
+static void *prefetch_worker(void *vargp) {
+  pjob_t job;
+  char *buf = malloc(PREFETCH_MAX_OBJECT);
+  long tokens = p_budget, now, last = mono_usec();
+
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), PREFETCH_NICE); /* Linux에서는 스레드 하나만 */
+  while (1) {
+    pthread_mutex_lock(&p_lock);
+    while (p_count == 0)
+      pthread_cond_wait(&p_ready, &p_lock);
+    job = p_queue[p_head];
+    p_head = (p_head + 1) % PREFETCH_QUEUE_LEN;
+    p_count--;
+    pthread_mutex_unlock(&p_lock);
+
+    now = mono_usec();
+    tokens += (long)((double)p_budget * (now - last) / 1000000);
+    last = now;
+    if (tokens < 0) {
+      usleep((useconds_t)(-(double)tokens * 1000000 / p_budget));
+      tokens = 0;
+      last = mono_usec();
+    }
+    if (tokens > (long)p_budget)
+      tokens = p_budget;
+
+    tokens -= prefetch_job(&job, buf);
+    free(job.host);
+    free(job.path);
+  }
+  return NULL;
+}
+
+void prefetch_stats(prefetch_stats_t *st) {
+  pthread_mutex_lock(&p_lock);
+  *st = p_stats;
+  pthread_mutex_unlock(&p_lock);
+}
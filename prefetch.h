@@ -0,0 +1,35 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <stddef.h>
+
+/*
+ * 링크 prefetch
+ * 캐시에 새로 넣은 HTML 응답에서 같은 origin을 가리키는 src=, href= 링크를 뽑아 대기열에 넣고,
+ * 백그라운드 스레드 하나가 (nice를 낮춰서) 엔드 서버에서 받아 미리 캐시한다.
+ * 브라우저가 바로 이어서 요청하는 이미지 등이 hit가 되도록.
+ * 받는 양은 초당 예산(bytes/s)을 넘지 않게 - 넘으면 그만큼 쉬었다가 다음 것
+ */
+
+#define PREFETCH_QUEUE_LEN 256    /* 대기열 길이 - 꽉 차면 버림 */
+#define PREFETCH_MAX_LINKS 32     /* 페이지 하나에서 넣는 최대 링크 수 */
+#define PREFETCH_MAX_OBJECT 102400 /* 이보다 큰 응답은 캐시할 수 없으니 받다가 그만둠 (MAX_OBJECT_SIZE) */
+#define PREFETCH_TIMEOUT_SEC 5    /* 엔드 서버 응답을 기다리는 최대 시간 */
+#define PREFETCH_NICE 19          /* prefetch 스레드의 nice - 요청 처리 스레드에게 CPU를 양보 */
+
+/* 통계용 스냅샷 */
+typedef struct prefetch_stats {
+    long queued;          /* 대기열에 넣은 링크 수 */
+    long fetched;         /* 받아서 캐시에 넣은 수 */
+    long skipped;         /* 이미 캐시에 있거나 주인이 다른 peer, 200이 아니라서 안 넣은 수 */
+    long dropped;         /* 대기열이 꽉 차서 버린 수 */
+    long bytes;           /* 엔드 서버에서 받은 바이트 수 */
+} prefetch_stats_t;
+
+int  prefetch_init(size_t budget);
+int  prefetch_enabled(void);
+void prefetch_submit(const char *host, size_t host_len, int port, const char *path, size_t path_len,
+                     const char *response, size_t len);
+void prefetch_stats(prefetch_stats_t *st);
+
+#endif
@@ -1,12 +1,25 @@
 #include <stdio.h>
 #include "csapp.h"
+#include "cache.h"
+#include "relay.h"
+#include "arena.h"
+#include "accesslog.h"
+#include "metrics.h"
+#include "disktier.h"
+#include "snapshot.h"
+#include "compress.h"
+#include "peer.h"
+#include "upstream.h"
+#include "cmem.h"
+#include "prefetch.h"
 
 /*
  * < proxy_cache.c >
  * Proxy Lab - Part III: Caching web objects
  *
- * cache replacement policies : LRU(Least Recently Used)
- *                              가장 오랫동안 참조되지 않은 페이지를 교체하는 기법
+ * cache replacement policies : CLOCK (LRU 근사)
+ *                              hit된 객체에 참조 비트를 세우고, hand가 돌면서
+ *                              비트가 꺼진 객체를 교체하는 기법 (hit에 lock이 필요 없음)
  */
 
 #define CONCURRENT // 주석 처리시 sequential proxy
@@ -23,6 +36,12 @@
 
 /* Recommended max object sizes */
 #define MAX_OBJECT_SIZE 102400
+/*
+ * MAX_OBJECT_SIZE보다 큰 객체는 SEGMENT_SIZE 조각으로 나눠 캐시한다.
+ * "key meta" = 응답 헤더, "key seg<i>" = body의 i번째 조각 (1MB 캐시에 여러 개 들어가도록 64KB)
+ * 캐시 용량의 절반보다 큰 객체는 Range로 받은 부분만 segment로 (통째로 흘려 넣으면 캐시를 다 밀어냄)
+ */
+#define SEGMENT_SIZE 65536
 
 /* ------------ global var ------------ */
 /* 코드 스타일 유지 & 간결한 표현을 위해 변수 설정 */
@@ -32,10 +51,11 @@ static const char *user_agent_hdr =
 static const char *connection_hdr = "Connection: close\r\n";
 static const char *proxy_connection_hdr = "Proxy-Connection: close\r\n";
 
-static const char *requestline_hdr_format = "GET %s HTTP/1.1\r\n";
 static const char *endof_hdr = "\r\n";
 
 /* error reponses */
+static const char *range_error_response =
+    "HTTP/1.0 416 Range Not Satisfiable\r\nContent-Range: bytes */%ld\r\nContent-length: 0\r\n\r\n";
 static const char *bad_request_response =
     "HTTP/1.0 400 Bad Request\r\n\r\n<html><body>Bad "
     "Request</body></html>\r\n\r\n";
@@ -45,57 +65,337 @@ static char *dns_error_response =
 static char *sock_error_response =
     "HTTP/1.0 500 Proxy Error\r\n\r\n<html><body>Socket "
     "Error</body></html>\r\n\r\n";
+static const char *forbidden_response =
+    "HTTP/1.0 403 Forbidden\r\n\r\n<html><body>PURGE is only allowed "
+    "from localhost</body></html>\r\n\r\n";
+
+/* 요청 헤더 블록의 최대 크기 - 넘으면 400 Bad Request */
+#define MAX_REQUEST_SIZE 65536
+/* DNS hostname 최대 길이 + '\0' */
+#define MAX_HOSTNAME 256
+/* 연결마다 쓰는 arena의 기본 chunk 크기 - 보통 요청은 이 안에서 끝남 */
+#define CONN_ARENA_CHUNK 16384
+/*
+ * 연결 스레드 스택 크기 (기본 8MB 대신)
+ * 큰 버퍼는 전부 arena에 두므로 rio_t 하나 + getaddrinfo 정도만 버티면 된다.
+ */
+#define PROXY_THREAD_STACK (256 * 1024)
+/*
+ * 동시에 처리하는 최대 연결 수
+ * 연결마다 slot 번호를 하나씩 주고, access log ring 같은 스레드별 자원을 slot 번호로 찾는다.
+ */
+#define MAX_CONN_SLOTS 1024
+/*
+ * -N을 안 줬을 때 음성 캐시 TTL(초) - 404/410 응답과 DNS 실패를 이만큼만 기억
+ * 없는 경로를 반복해서 찌르는 요청이 매번 엔드 서버까지 가지 않도록 (봇 트래픽)
+ */
+#define NEG_TTL_DEFAULT 10
+/* -S를 안 줬을 때 디스크 캐시 파일 크기 */
+#define DISK_DEFAULT_SIZE (1UL << 30)
+
+/*
+ * (pointer, length) 문자열 조각
+ * 읽기 버퍼(raw)를 가리키기만 하고 복사하지 않는다. '\0'으로 끝나지 않음!
+ */
+typedef struct
+{
+  const char *p;
+  size_t len;
+} span_t;
 
 /* 클라이언트의 요청 정보를 담을 구조체 */
 typedef struct
 {
   int port;
-  char host[MAXLINE];
-  char content[MAXLINE];
+  span_t method, uri, version; /* request line */
+  span_t host, path;           /* uri, Host 헤더에서 뽑아낸 부분 */
+  char *raw;                   /* 클라이언트가 보낸 요청 헤더 블록 원본 */
+  size_t raw_len;
+  char *content;               /* 엔드 서버로 보낼 요청, '\0'으로 끝남 */
+  size_t content_len, content_cap;
+  char *key;                   /* 캐시 key - "GET http://host:port/path" (Range 등 헤더와 무관) */
+  char *segkey;                /* 큰 객체의 조각 key를 만들 버퍼 (segment_key) */
+  int ranged;                  /* range를 206으로 잘라서 줘야 하면 1 */
+  long range_first, range_last; /* bytes=first-last, last < 0 이면 끝까지, first < 0 이면 마지막 last 바이트 */
+  int accept_enc;              /* 클라이언트가 받을 수 있는 ENC_* (-z 일 때만) */
+  span_t range_line, accept_line; /* 엔드 서버로는 안 보내는 Range, Accept-Encoding 줄 원본 (peer에게는 그대로) */
+  int from_peer;               /* 다른 proxy 노드가 넘긴 요청이면 1 -> 다시 peer로 넘기지 않음 */
+  int purge;                   /* PURGE 요청이면 1 - 엔드 서버로 보내지 않고 캐시에서 지움 */
+  span_t tags;                 /* PURGE의 Surrogate-Key 헤더 값 (공백으로 나뉜 tag들) */
+  backend_t *backend;          /* origin_connect가 pool에서 고른 backend, 요청이 끝나면 upstream_release */
+  arena_t *arena;              /* raw, content 등을 할당하는 연결별 arena */
 } HttpRequest;
 
+/*
+ * 클라이언트 연결 하나의 상태
+ * 스레드 스택 대신 heap에 두고, 요청 처리 중 필요한 메모리는 arena에서 받는다.
+ */
+typedef struct
+{
+  int connfd;
+  int slot;                      /* 0 ~ MAX_CONN_SLOTS-1, 연결이 끝나면 반납 */
+  char client[INET6_ADDRSTRLEN]; /* 클라이언트 IP (숫자 그대로, DNS 조회 X) */
+  rio_t rio;                     /* client ---> proxy 읽기 버퍼 */
+  arena_t arena;                 /* 요청마다 reset */
+} conn_t;
+
+/* 요청 하나를 처리한 결과 - access log, 통계용 */
+typedef struct
+{
+  int status;        /* 클라이언트에게 보낸 응답 상태 코드 */
+  int cache;         /* ALOG_CACHE_HIT / MISS / NONE */
+  size_t bytes;      /* 클라이언트에게 보낸 바이트 수 */
+  long connect_usec; /* 엔드 서버 연결에 걸린 시간, 안 했으면 -1 */
+  long ttfb_usec;    /* 엔드 서버 첫 응답 줄까지 걸린 시간, 안 받았으면 -1 */
+  int peer;          /* 주인 peer에게 받았으면 1, peer 연결에 실패해 엔드 서버로 갔으면 -1 */
+  int negative;      /* 음성 캐시(404/410, DNS 실패)로 답했으면 1 */
+} HttpResult;
+
+/* ------------ slot ------------ */
+/* 빈 slot 번호 stack - CS:APP sbuf처럼 세마포어 두 개로 관리 */
+static int slot_free[MAX_CONN_SLOTS];
+static int slot_top;
+static sem_t slot_mutex, slot_items;
+static cache_l1_t *slot_l1[MAX_CONN_SLOTS]; /* slot마다 hot 객체 L1 - 방금 반납된 slot부터 다시 쓰므로 따뜻하게 유지됨 */
+
+/* ------------ snapshot ------------ */
+static char *snap_path;        /* -W : 캐시 스냅샷 파일, NULL이면 사용 X */
+static int snap_interval;      /* -P : 주기적 저장 간격(초), 0이면 종료할 때만 */
+static sigset_t snap_signals;  /* 스냅샷 스레드만 받는 종료 시그널 */
+static char via_name[MAXLINE + 8]; /* 캐시 hit 응답의 Via 헤더 값 ("1.0 <self>") */
+static int neg_ttl = NEG_TTL_DEFAULT; /* -N : 음성 캐시 TTL(초), 0이면 404/410, DNS 실패를 캐시하지 않음 */
+static long seg_fill_max;      /* Range 없는 GET으로 받는 큰 객체를 통째로 segment에 넣는 최대 크기 (캐시 용량의 절반) */
+
 /* -----------declare func------------- */
 void sigpipe_handler(int sig);
-void proxy(int connfd);
+void proxy(conn_t *conn);
+conn_t *conn_new(int connfd, struct sockaddr_storage *clientaddr);
+void conn_free(conn_t *conn);
 void *proxy_thread(void *vargp);
-int parse_uri(const char *uri, int *port, char *hostname, char *pathname);
-int parse_http_request(rio_t *rio, HttpRequest *request);
-int parse_http_host(const char *host_header, char *hostname, int *port);
-void forward_http_request(int clientfd, HttpRequest *request);
+void *snapshot_thread(void *vargp);
+int parse_uri(span_t uri, int *port, span_t *host, span_t *path);
+int parse_http_request(rio_t *rio, HttpRequest *request, arena_t *arena);
+int parse_http_host(span_t value, span_t *host, int *port);
+void forward_http_request(int clientfd, HttpRequest *request, HttpResult *result);
+void slot_init(void);
+int slot_acquire(void);
+void slot_release(int slot);
+int parse_status(const char *response, size_t len);
+int origin_connect(int connfd, HttpRequest *request, HttpResult *result);
+int peer_forward(int peer, HttpRequest *request, HttpResult *result);
+int send_range(int connfd, HttpRequest *request, const char *response, size_t len, HttpResult *result);
+void send_cached(int connfd, cobj_t *obj, HttpResult *result);
+int send_cached_range(int connfd, HttpRequest *request, cobj_t *obj, HttpResult *result);
+void stream_segments(int connfd, rio_t *rio, HttpRequest *request, long off, long total,
+                     long first, long last, char *segbuf, HttpResult *result);
+int serve_segments(int connfd, HttpRequest *request, char *buf, HttpResult *result);
+void serve_metrics(int connfd, HttpResult *result);
+void serve_purge(conn_t *conn, HttpRequest *request, HttpResult *result);
+void record_metrics(int slot, HttpResult *result, long latency_usec, int bad);
+
+static void span_copy(char *dst, size_t size, span_t sp);
+static size_t parse_size(const char *s);
+static int parse_range(span_t value, HttpRequest *request);
+static char *segment_key(HttpRequest *request, long index);
+static char *variant_key(HttpRequest *request, int enc);
+static int range_build_header(int connfd, HttpRequest *request, const char *head, size_t head_len,
+                              long total, long *first, long *last, char **hdr, size_t *hlen, HttpResult *result);
+static int range_send_header(int connfd, HttpRequest *request, const char *head, size_t head_len,
+                             long total, long *first, long *last, HttpResult *result);
 
 /* -------------routine------------*/
 /* 루틴이란? 어떤 작업을 정의한 명령어(or 함수)의 집합을 의미 */
 int main(int argc, char **argv)
 {
-  int listenfd, connfd;
+  int listenfd, connfd, opt;
   socklen_t clientlen;
-  char hostname[MAXLINE], port[MAXLINE];
-  struct sockaddr_in clientaddr;
+  struct sockaddr_storage clientaddr;
   pthread_t tid; /* 멀티 쓰레드용 */
-  int *connfdp;
+  pthread_attr_t attr;
+  conn_t *conn;
+  char *access_log = NULL, *disk_path = NULL;
+  size_t disk_size = DISK_DEFAULT_SIZE, cache_size = 0, prefetch_budget = 0;
+  int use_compress = 0, npeers = 0, hugetlb = 0;
+  char *self = NULL, self_name[MAXLINE];
+  cache_stats_t cst;
+
+  /*
+   * 옵션 : -l <access log 파일>, -D <디스크 캐시 파일> -S <크기, K/M/G 단위 가능>
+   *        -W <스냅샷 파일> -P <스냅샷 주기(초)> -z (압축 variant 캐시)
+   *        -p <peer host:port> (여러 번) -n <다른 노드가 이 노드를 부르는 host:port>
+   *        -u <host[:port]=backend:port,backend:port,...> (여러 번)
+   *        -C <메모리 캐시 크기, K/M/G 단위 가능> -H (hugetlbfs 페이지 먼저)
+   *        -N <음성 캐시 TTL(초)> -F <prefetch 예산 bytes/s, K/M/G 단위 가능>
+   */
+  while ((opt = getopt(argc, argv, "l:D:S:W:P:zp:n:u:C:HN:F:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'l':
+      access_log = optarg;
+      break;
+    case 'D':
+      disk_path = optarg;
+      break;
+    case 'S':
+      disk_size = parse_size(optarg);
+      break;
+    case 'C':
+      cache_size = parse_size(optarg);
+      break;
+    case 'H':
+      hugetlb = 1;
+      break;
+    case 'N':
+      neg_ttl = atoi(optarg);
+      break;
+    case 'F':
+      prefetch_budget = parse_size(optarg);
+      break;
+    case 'W':
+      snap_path = optarg;
+      break;
+    case 'P':
+      snap_interval = atoi(optarg);
+      break;
+    case 'z':
+      use_compress = 1;
+      break;
+    case 'p':
+      if (peer_add(optarg) < 0)
+      {
+        fprintf(stderr, "Bad peer %s (host:port, at most %d)\n", optarg, PEER_MAX - 1);
+        exit(1);
+      }
+      npeers++;
+      break;
+    case 'n':
+      self = optarg;
+      break;
+    case 'u':
+      if (upstream_add(optarg) < 0)
+      {
+        fprintf(stderr, "Bad upstream pool %s (host[:port]=backend:port,...)\n", optarg);
+        exit(1);
+      }
+      break;
+    default:
+      argc = 0; /* 아래에서 사용법 출력 */
+    }
+  }
 
   /*
    * 들어온 인자 개수가 적절하지 않으면
    * 에러 메세지와 함께 사용 가이드를 출력
    */
-  if (argc != 2)
+  if (argc - optind != 1)
   {
     /*
      * 사용법을 에러메세지로 write.
      * stderr는 버퍼 없이 바로 출력하기 때문에
      * 어떤 상황이 와도 가장 빠르게 에러 메세지를 출력할 수 있도록 fprintf & stderr 사용
      */
-    fprintf(stderr, "Usage: %s <port>\n", argv[0]); // argv[0]은 ./proxy or ./tiny
+    fprintf(stderr, "Usage: %s [-l access_log] [-D disk_cache_file [-S size]] [-W snapshot_file [-P secs]] [-z] [-p peer ... [-n self]] [-u host=backend,... ...] [-C cache_size [-H]] [-N negative_ttl] [-F prefetch_budget] <port>\n", argv[0]); // argv[0]은 ./proxy or ./tiny
     exit(1);
   }
 
-  /* 캐시 초기화 */
-  cache_init();
+  /* 캐시 초기화 - 객체 메모리는 NUMA 노드별 arena에서 (-C로 크게 잡으면 huge page) */
+  cmem_init(cache_size, hugetlb);
+  if (cache_size > 0)
+    cache_init_capacity(cache_size);
+  else
+    cache_init();
+  cache_stats(&cst);
+  seg_fill_max = cst.capacity / 2;
+  slot_init();
+  metrics_init(MAX_CONN_SLOTS);
+
+  /*
+   * 지난번 스냅샷을 mmap - index만 만들고 내용은 hit될 때 검증하며 메모리로 올린다.
+   * 종료 시그널은 이후에 만드는 모든 스레드에서 막아 두고 스냅샷 스레드가 sigwait로 받음
+   */
+  if (snap_path != NULL)
+  {
+    if (snap_load(snap_path) < 0)
+      fprintf(stderr, "Ignoring unreadable snapshot %s\n", snap_path);
+    sigemptyset(&snap_signals);
+    sigaddset(&snap_signals, SIGINT);
+    sigaddset(&snap_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &snap_signals, NULL);
+    Pthread_create(&tid, NULL, snapshot_thread, NULL);
+  }
+
+  /* 캐시 reclaimer - 쫓아내기와 free를 요청 처리 스레드 대신 미리 해 둠 */
+  if (cache_reclaimer_start() < 0)
+  {
+    fprintf(stderr, "Cannot start cache reclaimer thread\n");
+    exit(1);
+  }
+
+  /* access log - writer 스레드가 slot별 ring을 비우며 파일에 씀 */
+  if (access_log != NULL && alog_init(access_log, MAX_CONN_SLOTS) < 0)
+  {
+    fprintf(stderr, "Cannot open access log %s: %s\n", access_log, strerror(errno));
+    exit(1);
+  }
+
+  /* 디스크 2차 캐시 - 메모리 캐시에서 쫓겨난 객체를 받아둠 */
+  if (disk_path != NULL && disk_init(disk_path, disk_size) < 0)
+  {
+    fprintf(stderr, "Cannot open disk cache %s: %s\n", disk_path, strerror(errno));
+    exit(1);
+  }
+
+  /* 압축 variant - 캐시에 넣은 텍스트 응답을 백그라운드 스레드가 gzip/br로 */
+  if (use_compress && compress_init() < 0)
+  {
+    fprintf(stderr, "Cannot start compression thread\n");
+    exit(1);
+  }
+
+  /* 링크 prefetch - HTML이 가리키는 같은 origin 객체를 백그라운드에서 미리 캐시 */
+  if (prefetch_budget > 0 && prefetch_init(prefetch_budget) < 0)
+  {
+    fprintf(stderr, "Cannot start prefetch thread\n");
+    exit(1);
+  }
+
+  /* 자기 이름 (peering, Via) - 안 주면 localhost:<port> */
+  if (self == NULL)
+  {
+    snprintf(self_name, sizeof(self_name), "localhost:%s", argv[optind]);
+    self = self_name;
+  }
+  snprintf(via_name, sizeof(via_name), "1.0 %s", self);
+
+  /* peering */
+  if (npeers > 0)
+  {
+    if (peer_init(self) < 0)
+    {
+      fprintf(stderr, "Bad self name %s (host:port)\n", self);
+      exit(1);
+    }
+  }
+
+  /* 엔드 서버 pool - health probe 스레드 */
+  if (upstream_init() < 0)
+  {
+    fprintf(stderr, "Cannot start upstream health check thread\n");
+    exit(1);
+  }
+
+  /* 클라이언트가 먼저 연결을 끊어도 프로세스가 죽지 않도록 SIGPIPE 처리 */
+  Signal(SIGPIPE, sigpipe_handler);
 
   /* client --------> proxy server (listenfd, connfd) */
   /* listen_fd 생성 */
   /* listenfd 식별자는 0, 1, 2 다음으로 최초로 생성되므로, 3! */
-  listenfd = open_listenfd(argv[1]);
+  listenfd = open_listenfd(argv[optind]);
+
+  /* 연결 스레드는 작은 스택으로 - 같은 메모리로 더 많은 연결을 동시에 */
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, PROXY_THREAD_STACK);
 
   /* 무한 loop 돌면서 client의 connection request 대기 */
   while (1)
@@ -107,32 +407,38 @@ int main(int argc, char **argv)
       continue; /* accept가 error 시 -1 리턴하므로 */
 
     /*
-     * accept에서 clientaddr 채워와서,
-     * 클라이언트의 hostname(IP) & port 정보를 얻어 버퍼로 복사한다.
-     * 이 때 설정된 hostname과 port가 연결 성공 시, 아래 연결 성공 메세지가 출력된다.
+     * accept에서 채워온 clientaddr는 conn_new에서 숫자 IP로만 바꿔 둔다.
+     * getnameinfo(역방향 DNS 조회)와 stdout lock을 잡는 printf는 accept loop에서 뺐고,
+     * 연결 정보는 요청이 끝날 때 access log에 남는다.
      */
-    getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
 
 /* Part I: Implementing a sequential web proxy */
 #ifndef CONCURRENT
-    printf("Accepted new connection from (%s, %s)\n", hostname, port);
-    proxy(connfd);
-    Close(connfd);
+    if ((conn = conn_new(connfd, &clientaddr)) == NULL)
+    {
+      Close(connfd);
+      continue;
+    }
+    proxy(conn);
+    conn_free(conn);
 /* Part II: Dealing with multiple concurrent requests */
 #else
     debug_printf("New Thread\n"); /* ifndef */
-    printf("Accepted new connection from (%s, %s)\n", hostname, port);
 
     /*
      * 스레드 생성 & concurrent proxy server start
      * 부모 프로세스는 while문 돌며 connection request 계속 받음
+     * (slot이 다 차 있으면 conn_new에서 하나가 끝날 때까지 기다림)
      */
-    connfdp = malloc(sizeof(int));
-    *connfdp = connfd;
-    if (0 != pthread_create(&tid, NULL, proxy_thread, connfdp))
+    if ((conn = conn_new(connfd, &clientaddr)) == NULL)
+    {
+      Close(connfd);
+      continue;
+    }
+    if (0 != pthread_create(&tid, &attr, proxy_thread, conn))
     {
       debug_printf("create new thread [%d] failed", tid);
-      free(connfdp);
+      conn_free(conn);
     }
 #endif
   }
@@ -140,153 +446,609 @@ int main(int argc, char **argv)
   return 0;
 }
 
-void proxy(int connfd)
+/* 지금 시각 (usec) - clock은 CLOCK_MONOTONIC or CLOCK_REALTIME */
+static long now_usec(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void proxy(conn_t *conn)
 {
-  rio_t fromcli_rio, toserv_rio;
   HttpRequest request;
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char host[MAXLINE], path[MAXLINE];
-  int port, toserverfd, irespond;
-  char toserverport[MAXLINE];
-  char toserverreq[MAXLINE];
+  HttpResult result = {0, ALOG_CACHE_NONE, 0, -1, -1, 0, 0};
+  alog_rec_t rec;
+  long start = now_usec(CLOCK_MONOTONIC), latency;
+  int bad = 0; /* 요청 파싱 실패 - request에 쓸 만한 값이 없음 */
+
+  /* 이 slot의 L1 - 자주 hit되는 작은 객체는 공유 캐시를 안 거침 */
+  cache_l1_bind(slot_l1[conn->slot]);
 
   /* client ---(request)---> (connfd)proxy server */
   /* 클라이언트에서 프록시 서버로 요청 */
-  rio_readinitb(&fromcli_rio, connfd);
-  if (parse_http_request(&fromcli_rio, &request) == -1)
+  if (parse_http_request(&conn->rio, &request, &conn->arena) == -1)
   {
     /* HTTP request 파싱에 실패했으면 에러 메세지 띄움 */
-    rio_writen(connfd, bad_request_response, strlen(bad_request_response));
+    rio_writen(conn->connfd, (char *)bad_request_response, strlen(bad_request_response));
+    bad = 1;
+    result.status = 400;
+    result.bytes = strlen(bad_request_response);
+  }
+  else if (request.path.len == strlen(METRICS_PATH) &&
+           memcmp(request.path.p, METRICS_PATH, request.path.len) == 0)
+  {
+    /* proxy 자체 통계 - 엔드 서버로 보내지 않음 */
+    serve_metrics(conn->connfd, &result);
+  }
+  else if (request.purge)
+  {
+    /* 캐시 무효화 - 엔드 서버로 보내지 않음 */
+    serve_purge(conn, &request, &result);
+  }
+  else
+  {
+    /* ifndef DEBUG - client의 host와 port를 출력 */
+    debug_printf("Host: %.*s, Port: %d\n", (int)request.host.len, request.host.p, request.port);
+
+    /* proxy ----(request)----> server */
+    /*       <---(response)----        */
+    /* client <---(response)--- proxy */
+    /* 클라이언트의 요청을 엔드 서버로 전달하고, 엔드 서버의 응답을 클라이언트로 전달 */
+    forward_http_request(conn->connfd, &request, &result);
+    if (request.backend != NULL)
+      upstream_release(request.backend);
+  }
+
+  latency = now_usec(CLOCK_MONOTONIC) - start;
+  record_metrics(conn->slot, &result, latency, bad);
+
+  /* access log - ring에 복사만 하고 파일 쓰기는 writer 스레드가 */
+  if (alog_enabled())
+  {
+    rec.ts_usec = now_usec(CLOCK_REALTIME);
+    strcpy(rec.client, conn->client);
+    if (bad)
+      rec.url[0] = '\0';
+    else
+      span_copy(rec.url, sizeof(rec.url), request.uri);
+    rec.status = result.status;
+    rec.cache = result.cache;
+    rec.bytes = result.bytes;
+    rec.latency_usec = latency;
+    alog_write(conn->slot, &rec);
+  }
+
+  /* 요청 하나 끝 - 이번 요청에서 쓴 메모리 한 번에 반납 */
+  arena_reset(&conn->arena);
+  cache_l1_bind(NULL);
+}
+
+/* 요청 하나의 결과를 이 slot의 통계에 더함 - bad : 요청 파싱 실패 (엔드 서버의 400과 구분) */
+void record_metrics(int slot, HttpResult *result, long latency_usec, int bad)
+{
+  metrics_add(slot, M_REQUESTS, 1);
+  if (bad)
+    metrics_add(slot, M_BAD_REQUESTS, 1);
+  if (result->cache == ALOG_CACHE_HIT)
+  {
+    metrics_add(slot, M_HITS, 1);
+    metrics_add(slot, M_BYTES_CACHE, result->bytes);
+  }
+  else if (result->cache == ALOG_CACHE_MISS)
+  {
+    metrics_add(slot, M_MISSES, 1);
+    metrics_add(slot, M_BYTES_ORIGIN, result->bytes);
+    if (result->connect_usec < 0) /* DNS, socket 에러 */
+      metrics_add(slot, M_ORIGIN_ERRORS, 1);
+  }
+  if (result->negative)
+    metrics_add(slot, M_NEGATIVE_HITS, 1);
+  if (result->peer > 0)
+    metrics_add(slot, M_PEER_REQUESTS, 1);
+  else if (result->peer < 0)
+    metrics_add(slot, M_PEER_FAILURES, 1);
+  metrics_observe(slot, H_LATENCY, latency_usec);
+  if (result->connect_usec >= 0)
+    metrics_observe(slot, H_CONNECT, result->connect_usec);
+  if (result->ttfb_usec >= 0)
+    metrics_observe(slot, H_TTFB, result->ttfb_usec);
+}
+
+/* METRICS_PATH 요청 - 모든 slot 통계를 합쳐 Prometheus text 형식으로 응답 */
+void serve_metrics(int connfd, HttpResult *result)
+{
+  char hdr[MAXLINE], *body;
+  size_t len;
+
+  if ((body = metrics_render(&len)) == NULL)
+  {
+    rio_writen(connfd, sock_error_response, strlen(sock_error_response));
+    result->status = 500;
     return;
   }
+  sprintf(hdr, "HTTP/1.0 200 OK\r\n"
+               "Content-Type: text/plain; version=0.0.4\r\n"
+               "Content-Length: %zu\r\n"
+               "Connection: close\r\n\r\n",
+          len);
+  rio_writen(connfd, hdr, strlen(hdr));
+  rio_writen(connfd, body, len);
+  result->status = 200;
+  result->bytes = strlen(hdr) + len;
+  free(body);
+}
 
-  /* ifndef DEBUG - client의 host와 port를 출력 */
-  debug_printf("Host: %s, Port: %d\n", request.host, request.port);
+/*
+ * PURGE 요청 - 캐시에서 지우고 지운 객체 수를 JSON으로 응답 (loopback 클라이언트만)
+ * PURGE http://host/a.html                  : 그 객체와 variant (gzip, br), segment
+ * PURGE http://host/static/<*>              : key가 http://host/static/ 로 시작하는 것 전부 (path가 '*'로 끝나면)
+ * PURGE http://host/ + Surrogate-Key: a b   : 응답의 Surrogate-Key에 a나 b가 있던 것 전부
+ */
+void serve_purge(conn_t *conn, HttpRequest *request, HttpResult *result)
+{
+  char hdr[MAXLINE], body[64], tag[MAXLINE];
+  const char *p, *end, *s;
+  size_t klen = strlen(request->key);
+  long purged = 0;
+
+  if (strncmp(conn->client, "127.", 4) != 0 && strcmp(conn->client, "::1") != 0 &&
+      strncmp(conn->client, "::ffff:127.", 11) != 0)
+  {
+    rio_writen(conn->connfd, (char *)forbidden_response, strlen(forbidden_response));
+    result->status = 403;
+    result->bytes = strlen(forbidden_response);
+    return;
+  }
+
+  if (request->tags.len > 0)
+  {
+    p = request->tags.p;
+    end = p + request->tags.len;
+    while (p < end)
+    {
+      while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+      for (s = p; p < end && *p != ' ' && *p != '\t'; p++)
+        ;
+      if (p > s)
+      {
+        span_copy(tag, sizeof(tag), (span_t){s, p - s});
+        purged += cache_purge_tag(tag);
+      }
+    }
+  }
+  else if (klen > 0 && request->key[klen - 1] == '*')
+  {
+    request->key[klen - 1] = '\0';
+    purged = cache_purge_prefix(request->key);
+  }
+  else
+    purged = cache_purge(request->key);
 
-  /* proxy ----(request)----> server */
-  /*       <---(response)----        */
-  /* client <---(response)--- proxy */
-  /* 클라이언트의 요청을 엔드 서버로 전달하고, 엔드 서버의 응답을 클라이언트로 전달 */
-  forward_http_request(connfd, &request);
+  sprintf(body, "{\"purged\":%ld}\n", purged);
+  sprintf(hdr, "HTTP/1.0 200 OK\r\n"
+               "Content-Type: application/json\r\n"
+               "Content-Length: %zu\r\n"
+               "Connection: close\r\n\r\n",
+          strlen(body));
+  rio_writen(conn->connfd, hdr, strlen(hdr));
+  rio_writen(conn->connfd, body, strlen(body));
+  result->status = 200;
+  result->bytes = strlen(hdr) + strlen(body);
+}
+
+/* slot 번호 0 ~ MAX_CONN_SLOTS-1 을 전부 빈 상태로 */
+void slot_init(void)
+{
+  int i;
+  for (i = 0; i < MAX_CONN_SLOTS; i++)
+  {
+    slot_free[i] = MAX_CONN_SLOTS - 1 - i;
+    slot_l1[i] = cache_l1_new();
+  }
+  slot_top = MAX_CONN_SLOTS;
+  Sem_init(&slot_mutex, 0, 1);
+  Sem_init(&slot_items, 0, MAX_CONN_SLOTS);
+}
+
+/* 빈 slot 하나 받기 - 없으면 반납될 때까지 기다림 */
+int slot_acquire(void)
+{
+  int slot;
+  P(&slot_items);
+  P(&slot_mutex);
+  slot = slot_free[--slot_top];
+  V(&slot_mutex);
+  return slot;
+}
+
+void slot_release(int slot)
+{
+  P(&slot_mutex);
+  slot_free[slot_top++] = slot;
+  V(&slot_mutex);
+  V(&slot_items);
+}
+
+/* 연결 상태 할당 - 실패하면 NULL */
+conn_t *conn_new(int connfd, struct sockaddr_storage *clientaddr)
+{
+  conn_t *conn = malloc(sizeof(conn_t));
+  if (conn == NULL)
+    return NULL;
+  conn->connfd = connfd;
+  conn->slot = slot_acquire();
+  /* 숫자 IP만 - 역방향 DNS 조회 없음 */
+  if (clientaddr->ss_family == AF_INET6)
+    inet_ntop(AF_INET6, &((struct sockaddr_in6 *)clientaddr)->sin6_addr, conn->client, sizeof(conn->client));
+  else
+    inet_ntop(AF_INET, &((struct sockaddr_in *)clientaddr)->sin_addr, conn->client, sizeof(conn->client));
+  rio_readinitb(&conn->rio, connfd);
+  arena_init(&conn->arena, CONN_ARENA_CHUNK);
+  return conn;
+}
+
+/* 연결 종료 - 소켓 닫고 arena, slot까지 반납 */
+void conn_free(conn_t *conn)
+{
+  close(conn->connfd);
+  arena_destroy(&conn->arena);
+  slot_release(conn->slot);
+  free(conn);
+}
+
+/*
+ * SIGPIPE 무시 - 끊긴 소켓에 write하면 -1(EPIPE)만 리턴되도록 한다.
+ */
+void sigpipe_handler(int sig)
+{
+  return;
+}
+
+/*
+ * 스냅샷 스레드 - snap_interval초마다, 그리고 SIGINT/SIGTERM을 받으면 캐시를 저장
+ * 시그널 핸들러 안에서는 lock을 잡을 수 없으니 sigtimedwait로 일반 스레드에서 처리한다.
+ */
+void *snapshot_thread(void *vargp)
+{
+  struct timespec ts = {snap_interval, 0};
+  int sig;
+
+  pthread_detach(pthread_self());
+  while (1)
+  {
+    sig = sigtimedwait(&snap_signals, NULL, snap_interval > 0 ? &ts : NULL);
+    if (sig < 0 && errno != EAGAIN)
+      continue; /* EINTR */
+    if (snap_save(snap_path) < 0)
+      fprintf(stderr, "Cannot write snapshot %s: %s\n", snap_path, strerror(errno));
+    if (sig > 0)
+    {
+      alog_flush();
+      exit(0);
+    }
+  }
+  return NULL;
 }
 
 void *proxy_thread(void *vargp)
 {
-  int connfd = *((int *)(vargp));
+  conn_t *conn = (conn_t *)vargp;
   /*
    * 스레드가 종료되면 스택에서 썼던 걸(공유자원이 아닌 것) 반납
    * 바로 삭제가 아니고, 종료될 때 까지 기다림!
    */
   pthread_detach(pthread_self());
-  free(vargp);
 
-  proxy(connfd);
-  close(connfd);
+  proxy(conn);
+  conn_free(conn);
   return NULL;
 }
 
+/* span이 name과 (대소문자 무시하고) 정확히 같으면 1 */
+static int span_ieq(span_t sp, const char *name)
+{
+  size_t len = strlen(name);
+  return sp.len == len && strncasecmp(sp.p, name, len) == 0;
+}
+
+/* "512M" 같은 크기 - K/M/G 단위 가능 */
+static size_t parse_size(const char *s)
+{
+  char *end;
+  size_t size = strtoull(s, &end, 10);
+
+  switch (*end)
+  {
+  case 'G': case 'g': size <<= 10; /* fall through */
+  case 'M': case 'm': size <<= 10; /* fall through */
+  case 'K': case 'k': size <<= 10;
+  }
+  return size;
+}
+
+/* span을 '\0'으로 끝나는 문자열로 복사 (dst 크기 size 만큼만) */
+static void span_copy(char *dst, size_t size, span_t sp)
+{
+  size_t len = sp.len < size - 1 ? sp.len : size - 1;
+  memcpy(dst, sp.p, len);
+  dst[len] = '\0';
+}
+
+/* 엔드 서버로 보낼 요청(request->content) 뒤에 len 바이트를 이어붙임 */
+static int content_append(HttpRequest *request, const char *data, size_t len)
+{
+  char *p;
+  size_t cap;
+  if (request->content_len + len + 1 > request->content_cap)
+  {
+    cap = request->content_cap ? request->content_cap : 1024;
+    while (request->content_len + len + 1 > cap)
+      cap *= 2;
+    if ((p = arena_grow(request->arena, request->content, request->content_len, cap)) == NULL)
+      return -1;
+    request->content = p;
+    request->content_cap = cap;
+  }
+  memcpy(request->content + request->content_len, data, len);
+  request->content_len += len;
+  request->content[request->content_len] = '\0';
+  return 0;
+}
+
+/* p ~ end 사이에서 c가 처음 나오는 곳, 없으면 end */
+static const char *scan_to(const char *p, const char *end, char c)
+{
+  const char *q = memchr(p, c, end - p);
+  return q ? q : end;
+}
+
 /*
  * uri -> host(IP), port, path 파싱
+ * 복사 없이 uri 안을 가리키는 span으로만 나눈다.
  */
-int parse_uri(const char *uri, int *port, char *hostname, char *pathname)
+int parse_uri(span_t uri, int *port, span_t *host, span_t *path)
 {
   /* uri : http://54.85.138.98:8000/home.html or /home.html */
-  /* 프로토콜 부분 삭제 */
-  const char *url = strncmp(uri, "http://", 7) == 0 ? uri + 7 : uri;
+  const char *p = uri.p, *end = uri.p + uri.len, *host_end;
 
-  /*
-   * ':' 문자가 있음 -> 포트번호가 있음
-   * ':'문자가 처음으로 등장하는 곳 다음의 포인터를 리턴
-   */
-  if (strchr(url, ':'))
-  {
-    sscanf(url, "%[^:]:%i%s", hostname, port, pathname); // 정규 표현식으로 ':'으로 구분된 지점을 나누어 hostname, port, pathname 구함
-  }
-  else
+  /* 프로토콜 부분 건너뜀 */
+  if (uri.len >= 7 && strncasecmp(p, "http://", 7) == 0)
+    p += 7;
+
+  /* '/' 전까지가 host[:port] (origin-form이면 비어 있음) */
+  path->p = scan_to(p, end, '/');
+  path->len = end - path->p;
+  if (path->p != p)
   {
-    /* 포트번호가 없을 때 */
-    *port = 80;
-    sscanf(url, "%[^/]%s", hostname, pathname);
+    host_end = scan_to(p, path->p, ':');
+    host->p = p;
+    host->len = host_end - p;
+    /* ':' 문자가 있음 -> 포트번호가 있음 */
+    *port = host_end < path->p ? atoi(host_end + 1) : 80;
   }
 
   /* 파일 경로가 없으면 root로 지정 */
-  if (pathname == NULL)
-    strcpy(pathname, "/");
-
+  if (path->len == 0)
+  {
+    path->p = "/";
+    path->len = 1;
+  }
   return 0;
 }
 
 /*
  * client의 request 메세지 파싱
+ * 1) 빈 줄(\r\n)까지의 요청 헤더 블록을 raw 버퍼 하나로 읽어들이고
+ * 2) 한 번 훑으면서 각 줄을 (pointer, length) span으로 나누며 엔드 서버로 보낼 요청을 만든다.
  */
-int parse_http_request(rio_t *rio, HttpRequest *request)
+int parse_http_request(rio_t *rio, HttpRequest *request, arena_t *arena)
 {
-  char line[MAXLINE], version[64], method[64], uri[MAXLINE], path[MAXLINE];
-  size_t rc;
-  rc = 0;
+  ssize_t n;
+  size_t cap;
+  char *buf;
+  const char *p, *end, *eol, *sp, *colon;
+  span_t name, value;
+  int if_range = 0;
+
+  memset(request, 0, sizeof(*request));
   request->port = 80; /* HTTP 기본 포트 */
-  rio_readlineb(rio, line, MAXLINE);
+  request->arena = arena;
+
   /*
-   * line에서 뽑아서 채움
+   * 1) 요청 헤더 블록 읽기 - raw 뒤에 바로 한 줄씩 붙여 읽는다
+   * 헤더 크기에 맞춰 arena 안에서 늘려가므로 고정 크기 배열이 필요 없음
+   */
+  cap = 2048;
+  if ((request->raw = arena_alloc(arena, cap)) == NULL)
+    return -1;
+  while (1)
+  {
+    if (cap - request->raw_len < 1024)
+    {
+      if (cap >= MAX_REQUEST_SIZE)
+        return -1; /* 헤더가 너무 큼 */
+      if ((buf = arena_grow(arena, request->raw, request->raw_len, cap * 2)) == NULL)
+        return -1;
+      request->raw = buf;
+      cap *= 2;
+    }
+    n = rio_readlineb(rio, request->raw + request->raw_len, cap - request->raw_len);
+    if (n < 0)
+    {
+      printf("Error when reading request!\n");
+      return -1;
+    }
+    if (n == 0) /* 빈 줄 없이 EOF */
+      break;
+    request->raw_len += n;
+    /* http request header 마지막 줄은 \r\n (긴 줄이 잘려 읽힌 꼬리와 구분하려면 앞 글자가 \n) */
+    if (request->raw_len > (size_t)n && strcmp(request->raw + request->raw_len - n, endof_hdr) == 0 &&
+        request->raw[request->raw_len - n - 1] == '\n')
+      break;
+  }
+  if (request->raw_len == 0) /* 읽자마자 EOF */
+    return -1;
+
+  /*
+   * 2) request line
    * ↓↓↓ example ↓↓↓
    * line : GET /home.html HTTP/1.1
    * method : GET
    * uri : /home.html
    * version : HTTP/1.1
    */
-  sscanf(line, "%s %s %s", method, uri, version);
+  p = request->raw;
+  end = request->raw + request->raw_len;
+  eol = scan_to(p, end, '\n');
+  if (eol > p && eol[-1] == '\r')
+    eol--;
+  sp = scan_to(p, eol, ' ');
+  request->method = (span_t){p, sp - p};
+  p = sp < eol ? sp + 1 : eol;
+  sp = scan_to(p, eol, ' ');
+  request->uri = (span_t){p, sp - p};
+  p = sp < eol ? sp + 1 : eol;
+  request->version = (span_t){p, eol - p};
 
-  /* GET 만 지원 */
-  if (strcasecmp(method, "GET") != 0)
+  /* GET 만 지원 (+ 캐시 무효화용 PURGE) */
+  request->purge = span_ieq(request->method, "PURGE");
+  if ((!span_ieq(request->method, "GET") && !request->purge) || request->uri.len == 0)
   {
-    printf("Error: %s is not supported!\n", method);
+    printf("Error: %.*s is not supported!\n", (int)request->method.len, request->method.p);
     return -1;
   }
-  debug_printf("Request from client: >---------%s", line); /* ifndef DEBUG */
+  debug_printf("Request from client: >---------%.*s\n", (int)(eol - request->raw), request->raw); /* ifndef DEBUG */
+
   /* URI 파싱 : host(client IP), port(client port), path(file path) */
-  parse_uri(uri, &(request->port), (char *)&(request->host), path);
+  parse_uri(request->uri, &request->port, &request->host, &request->path);
 
-  /* request line */
-  sprintf(request->content, requestline_hdr_format, path); /* 여기서 path는 /index.html 같은 거 /{filename} */
+  /* request line - 여기서 path는 /index.html 같은 거 /{filename} */
+  if (content_append(request, "GET ", 4) < 0 ||
+      content_append(request, request->path.p, request->path.len) < 0 ||
+      content_append(request, " HTTP/1.1\r\n", 11) < 0)
+    return -1;
 
-  /* 다음 헤더내용 한 줄씩 read */
-  while ((rc = rio_readlineb(rio, line, MAXLINE)) > 0)
+  /* 3) 나머지 헤더를 한 줄씩 name: value 로 나누며 처리 */
+  p = scan_to(p, end, '\n');
+  p = p < end ? p + 1 : end;
+  while (p < end)
   {
-    /* http request header 마지막 줄은 \r\n */
-    if (strcmp(line, endof_hdr) == 0)
+    eol = scan_to(p, end, '\n');
+    eol = eol < end ? eol + 1 : end; /* eol : 다음 줄 시작 */
+
+    colon = scan_to(p, eol, ':');
+    if (colon == eol)
     {
-      strcat(request->content, line);
-      break;
+      /* ':'이 없는 줄 (마지막 \r\n 포함)은 그대로 */
+      if (content_append(request, p, eol - p) < 0)
+        return -1;
+      p = eol;
+      continue;
     }
-    else if (strstr(line, "Host:"))
+    name = (span_t){p, colon - p};
+    value.p = colon + 1;
+    while (value.p < eol && (*value.p == ' ' || *value.p == '\t'))
+      value.p++;
+    value.len = eol - value.p;
+    while (value.len > 0 && isspace((unsigned char)value.p[value.len - 1]))
+      value.len--;
+
+    if (span_ieq(name, "Host"))
     {
-      strcat(request->content, line);
-      // Host: 192.168.1.1:8000
-      parse_http_host(line, (char *)&(request->host), &(request->port));
+      /* Host: 192.168.1.1:8000 */
+      parse_http_host(value, &request->host, &request->port);
+      n = content_append(request, p, eol - p);
     }
-    else if (strstr(line, "Connection:"))
+    else if (span_ieq(name, "Connection"))
+      n = content_append(request, connection_hdr, strlen(connection_hdr));
+    else if (span_ieq(name, "User-Agent"))
+      n = content_append(request, user_agent_hdr, strlen(user_agent_hdr));
+    else if (span_ieq(name, "Proxy-Connection"))
+      n = content_append(request, proxy_connection_hdr, strlen(proxy_connection_hdr));
+    else if (span_ieq(name, "Range"))
     {
-      strcat(request->content, connection_hdr);
+      /* 엔드 서버로 보내지 않음 - 전체를 받아 캐시하고, 자르는 건 프록시가 */
+      request->ranged = parse_range(value, request) == 0;
+      request->range_line = (span_t){p, eol - p};
+      n = 0;
     }
-    else if (strstr(line, "User-Agent:"))
+    else if (span_ieq(name, "Accept-Encoding") && compress_enabled())
     {
-      strcat(request->content, user_agent_hdr);
+      /* 엔드 서버에서는 identity로 받아 캐시하고, 압축은 프록시가 한 번만 */
+      request->accept_enc = compress_accept(value.p, value.len);
+      request->accept_line = (span_t){p, eol - p};
+      n = 0;
     }
-    else if (strstr(line, "Proxy-Connection:"))
+    else if (request->purge && span_ieq(name, "Surrogate-Key"))
     {
-      strcat(request->content, proxy_connection_hdr);
+      request->tags = value;
+      n = 0;
     }
-    else
+    else if (span_ieq(name, PEER_HDR))
+    {
+      request->from_peer = 1;
+      n = 0;
+    }
+    else if (span_ieq(name, "If-Range"))
     {
-      /* others */
-      strcat(request->content, line);
+      /* validator를 비교하지 않으므로 If-Range가 있으면 Range를 무시하고 전체를 줌 (RFC 허용) */
+      if_range = 1;
+      n = content_append(request, p, eol - p);
     }
+    else /* others */
+      n = content_append(request, p, eol - p);
+    if (n < 0)
+      return -1;
+    p = eol;
   }
-  if (rc < 0) /* 읽자마자 EOF */
-  {
-    printf("Error when reading request!\n");
+  if (if_range)
+    request->ranged = 0;
+
+  /* 캐시 key - 같은 객체면 요청 헤더가 달라도 (Range 포함) 같은 key */
+  cap = request->host.len + request->path.len + 32;
+  if ((request->key = arena_alloc(arena, cap)) == NULL)
+    return -1;
+  snprintf(request->key, cap, "GET http://%.*s:%d%.*s", (int)request->host.len, request->host.p,
+           request->port, (int)request->path.len, request->path.p);
+  if ((request->segkey = arena_alloc(arena, strlen(request->key) + 32)) == NULL)
     return -1;
+  return 0;
+}
+
+/*
+ * Range: bytes=first-last 하나만 지원 (bytes=100-, bytes=-500 포함)
+ * 여러 구간(,)이나 모르는 형식이면 -1 -> 전체를 200으로 (RFC상 서버가 Range를 무시해도 됨)
+ */
+static int parse_range(span_t value, HttpRequest *request)
+{
+  const char *p = value.p, *end = value.p + value.len;
+  char *q;
+
+  if (value.len < 7 || strncasecmp(p, "bytes=", 6) != 0 || scan_to(p, end, ',') != end)
+    return -1;
+  p += 6;
+  request->range_first = -1;
+  request->range_last = -1;
+  if (*p != '-')
+  {
+    request->range_first = strtol(p, &q, 10);
+    if (q == p || *q != '-')
+      return -1;
+    p = q;
+  }
+  p++; /* '-' */
+  if (p < end)
+  {
+    request->range_last = strtol(p, &q, 10);
+    if (q == p || q != end)
+      return -1;
   }
+  if (request->range_first < 0 && request->range_last < 0) /* "bytes=-" */
+    return -1;
+  if (request->range_first >= 0 && request->range_last >= 0 && request->range_last < request->range_first)
+    return -1;
   return 0;
 }
 
@@ -297,24 +1059,13 @@ int parse_http_request(rio_t *rio, HttpRequest *request)
  * host : 54.85.138.98
  * port : 8000
  */
-int parse_http_host(const char *host_header, char *hostname, int *port)
-{
-  char port_str[8];
-  char *host_begin = (char *)(host_header + 6); // skip 'Host:'
-  char *host_end = strstr(host_header, "\r\n");
-  char *port_begin = strchr(host_begin, ':');
-  size_t port_len;
-  if (port_begin == NULL) /* 포트 번호 없을 때 */
-    strncpy(hostname, host_begin, (size_t)(host_end - host_begin));
-  else
-  {
-    /* 포트 번호 있을 때 */
-    port_len = (size_t)(host_end - port_begin) - 1;
-    strncpy(hostname, host_begin, (size_t)(port_begin - host_begin));
-    strncpy(port_str, port_begin + 1, port_len);
-    port_str[port_len] = '\0';
-    *port = atoi(port_str);
-  }
+int parse_http_host(span_t value, span_t *host, int *port)
+{
+  const char *port_begin = scan_to(value.p, value.p + value.len, ':');
+  host->p = value.p;
+  host->len = port_begin - value.p;
+  if (port_begin < value.p + value.len) /* 포트 번호 있을 때 */
+    *port = atoi(port_begin + 1);
   return 0;
 }
 
@@ -323,63 +1074,776 @@ int parse_http_host(const char *host_header, char *hostname, int *port)
  * client                   [connfd] proxy [serverfd] ----(request)---->server
  *       <----(response)----                          <----(response)----
  */
-void forward_http_request(int connfd, HttpRequest *request)
+void forward_http_request(int connfd, HttpRequest *request, HttpResult *result)
 {
-  int serverfd, object_size, n;
-  char buf[MAXLINE], response_from_server[MAX_OBJECT_SIZE], port_str[8];
-  rio_t toserver_rio;
+  int serverfd, cacheable, defer, enc, cstate, eoh, peer, peered;
+  ssize_t n;
+  size_t len;
+  long content_length, t0, first, last;
+  char *buf, *response_from_server, *p;
+  cobj_t *obj;
+  rio_t *toserver_rio;
   debug_printf("Request to server: \n---------\n%s", request->content); /* ifndef DEBUG */
 
   /*
-   * 1) 만약 캐시가 client의 요청 응답을 가지고 있다면, (cache_get -> 0보다 큰 수 리턴)
-   *    connfd에 바로 write
+   * 1) 만약 캐시가 client의 요청 응답을 가지고 있다면, (cache_acquire -> 캐시 객체 리턴)
+   *    connfd에 바로 write (Range 요청이면 그 부분만 206으로)
    * 2) 캐시에 없는 요청이라면,
    *    일반적인 요청 & 응답 처리 후 캐시에 새로 저장
+   * miss일 때 쓰는 응답 버퍼는 스택 대신 이번 요청의 arena에서 받는다.
    */
-  if (cache_get(request->content, response_from_server)) /* 캐시 있으면 0보다 큰 수 리턴 -> True */
+  /* 압축을 받는 클라이언트면 압축 variant부터 (br 먼저) - Range는 identity 기준이라 제외 */
+  for (enc = ENC_BR; request->accept_enc && !request->ranged && enc >= ENC_GZIP; enc >>= 1)
+  {
+    if ((request->accept_enc & enc) && (obj = cache_acquire(variant_key(request, enc))) != NULL)
+    {
+      result->cache = ALOG_CACHE_HIT;
+      send_cached(connfd, obj, result);
+      cobj_put(obj);
+      return;
+    }
+  }
+  /* hit이면 캐시 객체를 복사하지 않고 빌려서 바로 보냄 */
+  if ((obj = cache_acquire(request->key)) != NULL)
   {
     debug_printf("Hit response in the cache!\n"); /* ifndef DEBUG */
-    rio_writen(connfd, response_from_server, strlen(response_from_server));
+    result->cache = ALOG_CACHE_HIT;
+    result->negative = obj->expires != 0; /* TTL이 붙는 건 음성 캐시뿐 */
+    if (!request->ranged || send_cached_range(connfd, request, obj, result) < 0)
+    {
+      /*
+       * variant가 아직 없거나 쫓겨났으면 다시 만들도록 (압축 대상이 아니면 헤더만 보고 버림)
+       * 받는 encoding이 전부 압축해도 줄지 않는다고 기록된 객체면 다시 하지 않음
+       */
+      if (request->accept_enc && !request->ranged && (request->accept_enc & ~atomic_load(&obj->no_enc)))
+        compress_submit(request->key, obj->data, obj->size);
+      send_cached(connfd, obj, result);
+    }
+    cobj_put(obj);
     return;
   }
 
-  sprintf(port_str, "%d", request->port);
-  serverfd = open_clientfd(request->host, port_str);
-  /* 에러 시 클라이언트 측에 메세지 출력 - socket 생성 실패 or getaddrinfo 실패 */
-  if (serverfd == -1)
+  response_from_server = arena_alloc(request->arena, MAX_OBJECT_SIZE);
+  if (response_from_server == NULL)
   {
-    /* socket 생성 실패 */
     rio_writen(connfd, sock_error_response, strlen(sock_error_response));
+    result->status = 500;
+    result->bytes = strlen(sock_error_response);
     return;
   }
-  else if (serverfd == -2)
-  {
-    /* getaddrinfo 실패 */
-    rio_writen(connfd, dns_error_response, strlen(dns_error_response));
+  /* 큰 객체 - 캐시된 segment로 (없는 부분은 엔드 서버에서 Range로, Range 요청이 아니면 bytes=0- 처럼) */
+  if (serve_segments(connfd, request, response_from_server, result) == 0)
     return;
+  result->cache = ALOG_CACHE_MISS;
+
+  /*
+   * 주인이 다른 노드인 key면 엔드 서버보다 먼저 그 peer에게 (요청은 peer_forward에서 보냄)
+   * peer가 캐시하므로 여기서는 캐시하지 않고, Range도 peer가 잘라 준 그대로 전달한다.
+   * peer에 연결이 안 되면 엔드 서버로
+   */
+  peered = 0;
+  if (!request->from_peer && (peer = peer_owner(request->key)) >= 0)
+  {
+    if ((serverfd = peer_forward(peer, request, result)) >= 0)
+      peered = 1;
+    else
+      result->peer = -1;
   }
+  if (!peered && (serverfd = origin_connect(connfd, request, result)) < 0)
+    return;
 
   /* proxy[serverfd] -----(request(from client)) ----> server */
   /* proxy [serverfd] ----(request)---->server */
-  rio_readinitb(&toserver_rio, serverfd);
-  rio_writen(serverfd, request->content, strlen(request->content));
+  buf = arena_alloc(request->arena, MAXLINE);
+  toserver_rio = arena_alloc(request->arena, sizeof(rio_t));
+  if (buf == NULL || toserver_rio == NULL)
+  {
+    close(serverfd);
+    return;
+  }
+  rio_readinitb(toserver_rio, serverfd);
+  if (!peered)
+    rio_writen(serverfd, request->content, request->content_len);
+  t0 = now_usec(CLOCK_MONOTONIC);
+
+  /*
+   * defer : Range 요청이면 전체 응답을 다 받아 캐시한 뒤에 잘라서 보내야 하므로
+   * 클라이언트로 바로 쓰지 않고 버퍼에 모으기만 한다.
+   * 버퍼를 넘어 캐시를 포기하게 되면 모은 것부터 보내고 Range 없이 200 전체로 전환.
+   */
+  defer = request->ranged && !peered;
+
+  /*
+   * 응답 헤더만 줄 단위로 읽으면서 Content-length로 body 크기를 확인
+   * len : response_from_server에 모아둔 바이트 수
+   */
+  len = 0;
+  cacheable = 1;
+  content_length = -1;
+  cstate = 0;
+  while ((n = rio_readlineb(toserver_rio, buf, MAXLINE)) > 0)
+  {
+    /*
+     * 압축 variant를 만들 수 있는 응답이면 identity에도 Vary를 붙여
+     * 중간 캐시가 Accept-Encoding별로 따로 저장하도록 (빈 줄 앞에 한 줄 추가)
+     */
+    eoh = strcmp(buf, endof_hdr) == 0;
+    if (compress_enabled())
+    {
+      if (!eoh)
+        compress_check_header(buf, n, &cstate);
+      else if (result->status == 200 && (cstate & (CH_TYPE | CH_VARY | CH_NO)) == CH_TYPE)
+        n = sprintf(buf, "Vary: Accept-Encoding\r\n\r\n");
+    }
+
+    /* 첫 줄은 status line - HTTP/1.0 200 OK */
+    if (result->status == 0)
+    {
+      result->status = parse_status(buf, n);
+      result->ttfb_usec = now_usec(CLOCK_MONOTONIC) - t0;
+    }
+    if (len + n > MAX_OBJECT_SIZE)
+    {
+      /* 헤더만으로 버퍼를 넘으면 캐시는 포기하고 모아둔 것부터 보냄 */
+      rio_writen(connfd, response_from_server, len);
+      result->bytes += len;
+      len = 0;
+      cacheable = 0;
+      defer = 0;
+    }
+    memcpy(response_from_server + len, buf, n);
+    len += n;
+
+    if (strncasecmp(buf, "Content-length:", 15) == 0)
+      content_length = atol(buf + 15);
+    if (eoh)
+      break;
+  }
+
+  /*
+   * 캐시에 못 넣을 만큼 큰 응답이면 body는 user 메모리를 거치지 않고
+   * serverfd -> pipe -> connfd 로 커널 안에서 바로 옮긴다. (zero-copy)
+   */
+  if (content_length > MAX_OBJECT_SIZE)
+  {
+    debug_printf("Splice relay: %ld bytes\n", content_length); /* ifndef DEBUG */
+    /* 큰 객체는 헤더만 "key meta"로 - 다음 요청이 크기와 헤더를 알고 segment를 찾을 수 있도록 */
+    if (result->status == 200 && !peered)
+      cache_place(segment_key(request, -1), response_from_server, len);
+    if (result->status == 200 && !peered && (defer || content_length <= seg_fill_max))
+    {
+      /* 흘려 보내면서 요청한 구간만 (Range가 없으면 전체) 전달하고, 지나가는 body는 segment로 캐시 */
+      if (!defer)
+      {
+        rio_writen(connfd, response_from_server, len);
+        result->bytes += len;
+        stream_segments(connfd, toserver_rio, request, 0, content_length, 0, content_length - 1,
+                        response_from_server, result);
+      }
+      else if (range_send_header(connfd, request, response_from_server, len, content_length, &first, &last,
+                                 result) == 0)
+        stream_segments(connfd, toserver_rio, request, 0, content_length, first, last, response_from_server, result);
+      close(serverfd);
+      return;
+    }
+    /* 모은 헤더는 write 한 번으로 클라이언트에게 */
+    rio_writen(connfd, response_from_server, len);
+    result->bytes += len;
+    /* 헤더를 읽다가 rio 내부 버퍼에 미리 들어온 body 부분부터 보냄 */
+    if (toserver_rio->rio_cnt > 0)
+    {
+      rio_writen(connfd, toserver_rio->rio_bufptr, toserver_rio->rio_cnt);
+      result->bytes += toserver_rio->rio_cnt;
+    }
+    if ((n = relay_splice(serverfd, connfd)) > 0)
+      result->bytes += n;
+    close(serverfd);
+    return;
+  }
+
+  /* 모은 헤더는 write 한 번으로 클라이언트에게 */
+  if (!defer)
+  {
+    rio_writen(connfd, response_from_server, len);
+    result->bytes += len;
+  }
+
+  /* body : 헤더를 읽다가 rio 내부 버퍼에 미리 들어온 부분 */
+  if (toserver_rio->rio_cnt > 0)
+  {
+    n = toserver_rio->rio_cnt;
+    if (cacheable && len + n <= MAX_OBJECT_SIZE)
+    {
+      memcpy(response_from_server + len, toserver_rio->rio_bufptr, n);
+      len += n;
+    }
+    else
+    {
+      cacheable = 0;
+      if (defer)
+      {
+        rio_writen(connfd, response_from_server, len);
+        result->bytes += len;
+        defer = 0;
+      }
+    }
+    if (!defer)
+    {
+      rio_writen(connfd, toserver_rio->rio_bufptr, n);
+      result->bytes += n;
+    }
+    toserver_rio->rio_cnt = 0;
+  }
 
-  object_size = 0;
-  while ((n = rio_readlineb(&toserver_rio, buf, MAXLINE)) > 0)
+  /*
+   * 나머지 body는 줄 단위가 아니라 큰 블록 단위로 read -> write
+   * 캐시 가능한 동안은 response_from_server 뒤에 바로 read해서 복사를 한 번 줄이고,
+   * MAX_OBJECT_SIZE를 넘으면 캐시를 포기하고 버퍼 전체를 relay용으로 재사용한다.
+   */
+  while (1)
   {
-    object_size += n;
-    if (object_size <= MAX_OBJECT_SIZE)
-      /* proxy[serverfd] <----(response)---- server */
-      strcat(response_from_server, buf);
+    if (cacheable && len < MAX_OBJECT_SIZE)
+    {
+      p = response_from_server + len;
+      n = read(serverfd, p, MAX_OBJECT_SIZE - len);
+    }
+    else
+    {
+      if (defer)
+      {
+        /* 버퍼를 재사용하기 전에 모아둔 응답부터 */
+        rio_writen(connfd, response_from_server, len);
+        result->bytes += len;
+        defer = 0;
+      }
+      p = response_from_server;
+      n = read(serverfd, p, MAX_OBJECT_SIZE);
+      if (n > 0)
+        cacheable = 0;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      if (n < 0)
+        cacheable = 0;
+      break;
+    }
+    if (cacheable)
+      len += n;
+    if (defer)
+      continue;
 
     /* client <----(response)---- [connfd] proxy */
-    rio_writen(connfd, buf, n);
+    if (rio_writen(connfd, p, n) < 0)
+    {
+      cacheable = 0; /* 클라이언트가 끊었으면 응답이 완전하지 않을 수 있으니 캐시하지 않음 */
+      break;
+    }
+    result->bytes += n;
+  }
+
+  debug_printf("Response from server : %zu bytes\n", len); /* ifndef DEBUG */
+
+  /* 새로운 요청에 대한 응답을 캐시에 저장 (텍스트면 압축 variant는 백그라운드에서) */
+  if (cacheable && !peered)
+  {
+    if (result->status == 404 || result->status == 410)
+    {
+      /* 없는 객체는 짧게만 기억 (-N 0이면 캐시하지 않음) */
+      if (neg_ttl > 0)
+        cache_place_ttl(request->key, response_from_server, len, neg_ttl);
+    }
+    else
+    {
+      cache_place(request->key, response_from_server, len);
+      compress_submit(request->key, response_from_server, len);
+      prefetch_submit(request->host.p, request->host.len, request->port, request->path.p, request->path.len,
+                      response_from_server, len);
+    }
+  }
+  close(serverfd);
+
+  /* Range 요청 - 전체를 받아 캐시한 뒤 요청한 부분만 (200이 아니면 받은 그대로) */
+  if (defer && !(cacheable && send_range(connfd, request, response_from_server, len, result) == 0))
+  {
+    rio_writen(connfd, response_from_server, len);
+    result->bytes += len;
+  }
+}
+
+/*
+ * 엔드 서버 연결 - 실패하면 클라이언트에게 500 에러를 보내고 (connfd < 0 이면 안 보냄) -1
+ * connect에 걸린 시간은 result->connect_usec에
+ */
+int origin_connect(int connfd, HttpRequest *request, HttpResult *result)
+{
+  int serverfd, pool;
+  long t0;
+  char port_str[8], hostname[MAX_HOSTNAME], dnskey[MAX_HOSTNAME + 8];
+  const char *error_response;
+  cobj_t *obj;
+
+  sprintf(port_str, "%d", request->port);
+  span_copy(hostname, sizeof(hostname), request->host);
+  t0 = now_usec(CLOCK_MONOTONIC);
+  /* -u pool에 있는 host면 그 backend 중 하나로 (안 되는 backend는 빼고 다음 것) */
+  if ((pool = upstream_find(hostname, request->port)) >= 0)
+  {
+    if (request->backend != NULL)
+      upstream_release(request->backend);
+    request->backend = NULL;
+    serverfd = upstream_connect(pool, &request->backend);
+  }
+  else
+  {
+    /* 얼마 전에 DNS 조회가 실패한 host면 getaddrinfo 없이 바로 실패 (음성 캐시, 크기 0인 객체) */
+    snprintf(dnskey, sizeof(dnskey), "DNS %s", hostname);
+    if (neg_ttl > 0 && (obj = cache_acquire(dnskey)) != NULL)
+    {
+      cobj_put(obj);
+      serverfd = -2;
+      result->negative = 1;
+      if (connfd >= 0)
+        result->cache = ALOG_CACHE_HIT;
+    }
+    else if ((serverfd = open_clientfd(hostname, port_str)) == -2 && neg_ttl > 0)
+      cache_place_ttl(dnskey, "", 0, neg_ttl);
+  }
+  result->connect_usec = now_usec(CLOCK_MONOTONIC) - t0;
+  if (serverfd >= 0)
+    return serverfd;
+
+  /* 에러 시 클라이언트 측에 메세지 출력 - socket 생성 실패(-1) or getaddrinfo 실패(-2) */
+  result->connect_usec = -1;
+  if (connfd < 0)
+    return -1; /* 이미 응답을 보내는 중 */
+  error_response = serverfd == -2 ? dns_error_response : sock_error_response;
+  rio_writen(connfd, (char *)error_response, strlen(error_response));
+  result->status = 500;
+  result->bytes = strlen(error_response);
+  return -1;
+}
+
+/*
+ * 주인 peer에게 proxy 요청을 보냄 - 연결된 fd, 실패하면 -1 (클라이언트에게는 아무것도 안 보냄)
+ * request line은 절대 URI로, 엔드 서버용으로 뺐던 Range / Accept-Encoding 줄은 되살리고
+ * PEER_HDR를 붙여서 받은 peer가 다시 넘기지 않도록 한다.
+ */
+int peer_forward(int peer, HttpRequest *request, HttpResult *result)
+{
+  int serverfd;
+  long t0;
+  size_t cap, len;
+  char *req;
+  const char *headers, *end;
+
+  t0 = now_usec(CLOCK_MONOTONIC);
+  serverfd = peer_connect(peer);
+  if (serverfd < 0)
+    return -1;
+  result->connect_usec = now_usec(CLOCK_MONOTONIC) - t0;
+  result->peer = 1;
+
+  /* content = "GET /path HTTP/1.1\r\n" + 헤더들 + "\r\n" */
+  headers = scan_to(request->content, request->content + request->content_len, '\n') + 1;
+  end = request->content + request->content_len;
+  if (end - headers >= 2 && memcmp(end - 2, endof_hdr, 2) == 0)
+    end -= 2;
+  cap = strlen(request->key) + (end - headers) + request->range_line.len +
+        request->accept_line.len + strlen(peer_name(0)) + 64;
+  if ((req = arena_alloc(request->arena, cap)) == NULL)
+  {
+    close(serverfd);
+    return -1;
+  }
+  /* key = "GET http://host:port/path" */
+  len = sprintf(req, "%s HTTP/1.1\r\n", request->key);
+  memcpy(req + len, headers, end - headers);
+  len += end - headers;
+  if (request->ranged)
+  {
+    memcpy(req + len, request->range_line.p, request->range_line.len);
+    len += request->range_line.len;
+  }
+  if (request->accept_line.len > 0)
+  {
+    memcpy(req + len, request->accept_line.p, request->accept_line.len);
+    len += request->accept_line.len;
+  }
+  len += sprintf(req + len, "%s: %s\r\n\r\n", PEER_HDR, peer_name(0));
+  rio_writen(serverfd, req, len);
+  return serverfd;
+}
+
+/*
+ * 전체 크기 total인 객체에서 request의 Range 구간 [*first, *last] 계산
+ * suffix(bytes=-N)면 마지막 N바이트, last가 없거나 넘치면 끝까지
+ * 리턴값 : 만족할 수 없는 구간이면 -1 (416)
+ */
+static int range_resolve(HttpRequest *request, long total, long *first, long *last)
+{
+  if (request->range_first < 0)
+  {
+    *first = request->range_last < total ? total - request->range_last : 0;
+    *last = total - 1;
+  }
+  else
+  {
+    *first = request->range_first;
+    *last = request->range_last < 0 || request->range_last >= total ? total - 1 : request->range_last;
+  }
+  return *first < total ? 0 : -1;
+}
+
+/*
+ * 원래 응답 헤더 블록(status line ~ 빈 줄)으로 206 헤더를 만듦 - *hdr (arena)에 마지막 빈 줄은 빼고
+ * Content-length를 바꾸고 Content-Range를 붙이며, 구간이 안 맞으면 416을 여기서 보냄
+ * 리턴값 : 헤더를 만들었고 body 구간을 보내야 하면 0, 416으로 끝났으면 1, 에러 -1
+ */
+static int range_build_header(int connfd, HttpRequest *request, const char *head, size_t head_len,
+                              long total, long *first, long *last, char **hdr, size_t *hlen, HttpResult *result)
+{
+  const char *line, *eol, *end = head + head_len;
+  char *h;
+  size_t n;
+
+  if ((h = arena_alloc(request->arena, head_len + 192)) == NULL)
+    return -1;
+  if (range_resolve(request, total, first, last) < 0)
+  {
+    n = sprintf(h, range_error_response, total);
+    rio_writen(connfd, h, n);
+    result->status = 416;
+    result->bytes += n;
+    return 1;
+  }
+  n = sprintf(h, "HTTP/1.0 206 Partial Content\r\n");
+  line = scan_to(head, end, '\n') + 1; /* status line 다음부터 */
+  while (line < end - 2)               /* 마지막 빈 줄 전까지 */
+  {
+    eol = scan_to(line, end, '\n') + 1;
+    if (strncasecmp(line, "Content-length:", 15) != 0 && strncasecmp(line, "Content-Range:", 14) != 0)
+    {
+      memcpy(h + n, line, eol - line);
+      n += eol - line;
+    }
+    line = eol;
+  }
+  n += sprintf(h + n, "Content-Range: bytes %ld-%ld/%ld\r\nContent-length: %ld\r\n",
+               *first, *last, total, *last - *first + 1);
+  result->status = 206;
+  *hdr = h;
+  *hlen = n;
+  return 0;
+}
+
+/*
+ * range_build_header로 만든 206 헤더를 빈 줄까지 붙여 바로 보냄
+ * 리턴값 : 헤더를 보냈고 body 구간을 보내야 하면 0, 416으로 끝났으면 1, 에러 -1
+ */
+static int range_send_header(int connfd, HttpRequest *request, const char *head, size_t head_len,
+                             long total, long *first, long *last, HttpResult *result)
+{
+  char *hdr;
+  size_t hlen;
+  int rc;
+
+  if ((rc = range_build_header(connfd, request, head, head_len, total, first, last, &hdr, &hlen, result)) != 0)
+    return rc;
+  hlen += sprintf(hdr + hlen, "\r\n");
+  rio_writen(connfd, hdr, hlen);
+  result->bytes += hlen;
+  return 0;
+}
+
+/*
+ * 엔드 서버에서 다 받아 둔 전체 응답(200)에서 request의 Range 부분만 206 Partial Content로 보냄 (hit은 send_cached_range)
+ * 리턴값 : 보냈으면 0, 200 응답이 아니라 못 자르면 -1 (호출한 쪽이 전체를 보냄)
+ */
+int send_range(int connfd, HttpRequest *request, const char *response, size_t len, HttpResult *result)
+{
+  const char *body;
+  long first, last;
+  int rc;
+
+  if (parse_status(response, len) != 200)
+    return -1;
+  /* 헤더 끝 (빈 줄) 찾기 */
+  for (body = response; body + 4 <= response + len && memcmp(body, "\r\n\r\n", 4) != 0; body++)
+    ;
+  if (body + 4 > response + len)
+    return -1;
+  body += 4;
+
+  if ((rc = range_send_header(connfd, request, response, body - response, response + len - body,
+                              &first, &last, result)) != 0)
+    return rc < 0 ? -1 : 0;
+  rio_writen(connfd, (char *)body + first, last - first + 1);
+  result->bytes += last - first + 1;
+  return 0;
+}
+
+/* MSG_ZEROCOPY 완료 통지가 늦을 때 relay_defer에 같이 넘기는 것 - 통지가 오면 zc_release */
+typedef struct
+{
+  cobj_t *obj;       /* body를 커널이 아직 읽을 수 있음 */
+  char hdr[MAXLINE]; /* Age, Via, X-Cache 줄도 마찬가지 */
+  char head[];       /* 캐시 객체 밖에서 만든 헤더 (206) 복사본 */
+} zc_hold_t;
+
+static void zc_release(void *arg)
+{
+  zc_hold_t *hold = (zc_hold_t *)arg;
+
+  cobj_put(hold->obj);
+  free(hold);
+}
+
+/*
+ * 캐시 객체 obj의 hit 응답을 보냄
+ * head (빈 줄 앞까지) + 이번 응답의 Age, Via, X-Cache + 빈 줄 + body를 writev 한 번으로, head가 NULL이면 body만
+ * body는 캐시 메모리에서 복사 없이 나가고, 크면 MSG_ZEROCOPY로
+ * 완료 통지가 기다려도 안 오면 객체 참조와 헤더를 relay_defer로 넘겨 통지가 온 뒤에 놓는다.
+ * (먼저 놓으면 그 cmem 자리에 들어온 다른 객체의 내용이 나갈 수 있음)
+ * copy_head : head가 obj 밖 (arena)에 있음 - zerocopy면 같이 넘기도록 hold에 복사
+ */
+static void send_hit(int connfd, cobj_t *obj, const char *head, size_t head_len, int copy_head,
+                     const char *body, size_t body_len, HttpResult *result)
+{
+  char buf[MAXLINE], *hdr = buf;
+  struct iovec iov[3];
+  zc_hold_t *hold = NULL;
+  unsigned long pending;
+  long age;
+  int n = 0, zerocopy = body_len >= ZEROCOPY_MIN;
+
+  /* zerocopy면 헤더도 커널이 나중에 읽을 수 있으므로 스택, arena 대신 heap에 */
+  if (zerocopy && (hold = malloc(sizeof(zc_hold_t) + (copy_head ? head_len : 0))) == NULL)
+    zerocopy = 0;
+  if (hold != NULL)
+  {
+    hdr = hold->hdr;
+    if (copy_head)
+      head = memcpy(hold->head, head, head_len);
+  }
+
+  if (head != NULL)
+  {
+    age = (long)(time(NULL) - obj->stored);
+    iov[n].iov_base = (char *)head;
+    iov[n++].iov_len = head_len;
+    iov[n].iov_base = hdr;
+    iov[n++].iov_len = snprintf(hdr, MAXLINE, "Age: %ld\r\nVia: %s\r\nX-Cache: HIT\r\n\r\n",
+                                age > 0 ? age : 0, via_name);
+    result->bytes += head_len + iov[1].iov_len;
+  }
+  iov[n].iov_base = (char *)body;
+  iov[n++].iov_len = body_len;
+  result->bytes += body_len;
+  relay_sendv(connfd, iov, n, zerocopy, &pending);
+  if (pending == 0)
+  {
+    free(hold);
+    return;
+  }
+  /* 부른 쪽의 cobj_put과 따로 참조 하나를 더 잡아서 넘김 - 넘기지 못하면 놓을 때를 모르므로 그대로 둠 */
+  cobj_get(obj);
+  hold->obj = obj;
+  relay_defer(connfd, pending, zc_release, hold);
+}
+
+/* 캐시 객체를 hit 응답으로 보냄 - 저장해 둔 헤더 블록에 Age, Via, X-Cache를 붙여서 (send_hit) */
+void send_cached(int connfd, cobj_t *obj, HttpResult *result)
+{
+  result->status = parse_status(obj->data, obj->size);
+  if (obj->hlen == 0) /* HTTP 응답 모양이 아니면 받은 그대로 */
+    send_hit(connfd, obj, NULL, 0, 0, obj->data, obj->size, result);
+  else
+    send_hit(connfd, obj, obj->data, obj->hlen - 2, 0, obj->data + obj->hlen, obj->size - obj->hlen, result);
+}
+
+/*
+ * 캐시 객체 (200)에서 request의 Range 부분만 206 hit 응답으로 - 헤더는 send_cached처럼 Age, Via, X-Cache까지
+ * 리턴값 : 보냈으면 0 (416 포함), 200 응답이 아니라 못 자르면 -1 (호출한 쪽이 전체를 보냄)
+ */
+int send_cached_range(int connfd, HttpRequest *request, cobj_t *obj, HttpResult *result)
+{
+  long first, last;
+  char *hdr;
+  size_t hlen;
+  int rc;
+
+  if (obj->hlen == 0 || parse_status(obj->data, obj->size) != 200)
+    return -1;
+  if ((rc = range_build_header(connfd, request, obj->data, obj->hlen, obj->size - obj->hlen,
+                               &first, &last, &hdr, &hlen, result)) != 0)
+    return rc < 0 ? -1 : 0;
+  send_hit(connfd, obj, hdr, hlen, 1, obj->data + obj->hlen + first, last - first + 1, result);
+  return 0;
+}
+
+/* 압축 variant의 캐시 key - "key gzip", "key br" (segment_key와 같은 버퍼) */
+static char *variant_key(HttpRequest *request, int enc)
+{
+  snprintf(request->segkey, strlen(request->key) + 32, "%s%c%s", request->key, CACHE_KEY_SEP, compress_name(enc));
+  return request->segkey;
+}
+
+/*
+ * 큰 객체의 캐시 key - index < 0 이면 "key meta" (응답 헤더), 아니면 "key seg<index>"
+ * 이번 요청의 arena에 만든 문자열을 리턴 (같은 요청 안에서 다음 호출까지 유효)
+ */
+static char *segment_key(HttpRequest *request, long index)
+{
+  size_t size = strlen(request->key) + 32; /* parse_http_request에서 이만큼 받아 둠 */
+
+  if (index < 0)
+    snprintf(request->segkey, size, "%s%c%s", request->key, CACHE_KEY_SEP, CACHE_META_SUFFIX);
+  else
+    snprintf(request->segkey, size, "%s%cseg%ld", request->key, CACHE_KEY_SEP, index);
+  return request->segkey;
+}
+
+/*
+ * 엔드 서버 응답 body를 읽으면서 (off : 지금 읽을 위치의 객체 내 offset)
+ * - SEGMENT_SIZE 경계에 맞춰 모은 조각이 완성되면 "key seg<i>"로 캐시
+ * - [first, last]에 걸치는 부분은 클라이언트에게 보냄
+ * last가 속한 조각의 끝까지만 읽고 멈춘다. segbuf는 SEGMENT_SIZE 이상
+ */
+void stream_segments(int connfd, rio_t *rio, HttpRequest *request, long off, long total,
+                     long first, long last, char *segbuf, HttpResult *result)
+{
+  long stop = (last / SEGMENT_SIZE + 1) * SEGMENT_SIZE, base, s, e;
+  ssize_t n;
+  int whole = off % SEGMENT_SIZE == 0; /* 조각 처음부터 받고 있어야 캐시 가능 */
+
+  if (stop > total)
+    stop = total;
+  while (off < stop)
+  {
+    base = off - off % SEGMENT_SIZE;
+    n = SEGMENT_SIZE - off % SEGMENT_SIZE;
+    if (n > stop - off)
+      n = stop - off;
+    if ((n = rio_readnb(rio, segbuf + off % SEGMENT_SIZE, n)) <= 0)
+      break;
+
+    /* 이번에 읽은 [off, off + n) 중 [first, last]에 걸치는 부분 */
+    s = first > off ? first : off;
+    e = last + 1 < off + n ? last + 1 : off + n;
+    if (s < e)
+    {
+      if (rio_writen(connfd, segbuf + (s - base), e - s) < 0)
+        break;
+      result->bytes += e - s;
+    }
+    off += n;
+
+    if (off % SEGMENT_SIZE == 0 || off == total)
+    {
+      if (whole)
+        cache_place(segment_key(request, base / SEGMENT_SIZE), segbuf, off - base);
+      whole = 1;
+    }
+  }
+}
+
+/*
+ * 큰 객체의 요청을 segment로 처리 - Range가 없으면 bytes=0- 로 보고 저장해 둔 200 헤더 그대로
+ * "key meta"가 없으면 (처음 보는 객체) -1 -> 평소처럼 엔드 서버로
+ * 캐시에 있는 조각은 그대로 보내고, 처음으로 빠진 조각부터 필요한 끝까지는
+ * 엔드 서버에 Range로 한 번에 받아서 보내며 캐시한다. (Range를 무시하고 200을 주는 서버도 처리)
+ */
+int serve_segments(int connfd, HttpRequest *request, char *buf, HttpResult *result)
+{
+  long total, first, last, i, s, e, off, start;
+  size_t len, n;
+  int serverfd, rc;
+  char *hdr, *p;
+  rio_t *rio;
+
+  if ((len = cache_get(segment_key(request, -1), buf)) == 0)
+    return -1;
+  /* meta = 원래 200 응답 헤더, Content-length가 전체 크기 */
+  for (total = -1, p = buf; p < buf + len; p = (char *)scan_to(p, buf + len, '\n') + 1)
+    if (strncasecmp(p, "Content-length:", 15) == 0)
+      total = atol(p + 15);
+  if (total <= MAX_OBJECT_SIZE || (!request->ranged && total > seg_fill_max))
+    return -1; /* 통째로 segment에 넣지 않는 크기 - 평소처럼 엔드 서버에서 splice */
+
+  result->cache = ALOG_CACHE_HIT;
+  if (!request->ranged)
+  {
+    first = 0;
+    last = total - 1;
+    rio_writen(connfd, buf, len);
+    result->status = 200;
+    result->bytes += len;
+  }
+  else if ((rc = range_send_header(connfd, request, buf, len, total, &first, &last, result)) != 0)
+    return rc < 0 ? -1 : 0;
+
+  for (i = first / SEGMENT_SIZE; i <= last / SEGMENT_SIZE; i++)
+  {
+    if ((n = cache_get(segment_key(request, i), buf)) == 0)
+      break;
+    s = first > i * SEGMENT_SIZE ? first : i * SEGMENT_SIZE;
+    e = last < i * SEGMENT_SIZE + (long)n - 1 ? last : i * SEGMENT_SIZE + (long)n - 1;
+    if (s <= e)
+    {
+      rio_writen(connfd, buf + (s - i * SEGMENT_SIZE), e - s + 1);
+      result->bytes += e - s + 1;
+    }
   }
+  if (i > last / SEGMENT_SIZE)
+    return 0;
 
-  debug_printf("Response from server :\n-----------\n%s", response_from_server); /* ifndef DEBUG */
+  /*
+   * 빠진 조각 i부터 last가 속한 조각 끝까지 엔드 서버에 요청
+   * 206 헤더는 이미 보냈으므로 연결에 실패해도 에러 응답은 보내지 않음 (connfd = -1)
+   */
+  result->cache = ALOG_CACHE_MISS;
+  if ((serverfd = origin_connect(-1, request, result)) < 0)
+    return 0;
+  len = request->content_len;
+  if (len >= 4 && memcmp(request->content + len - 4, "\r\n\r\n", 4) == 0)
+    len -= 2; /* 마지막 빈 줄 앞에 Range 줄을 끼움 */
+  e = (last / SEGMENT_SIZE + 1) * SEGMENT_SIZE;
+  hdr = arena_alloc(request->arena, 64);
+  rio = arena_alloc(request->arena, sizeof(rio_t));
+  if (hdr == NULL || rio == NULL)
+  {
+    close(serverfd);
+    return 0;
+  }
+  rio_writen(serverfd, request->content, len);
+  len = sprintf(hdr, "Range: bytes=%ld-%ld\r\n\r\n", i * SEGMENT_SIZE, (e < total ? e : total) - 1);
+  rio_writen(serverfd, hdr, len);
 
-  /* 새로운 요청에 대한 응답을 캐시에 저장 */
-  if (object_size <= MAX_OBJECT_SIZE)
-    cache_place(request->content, response_from_server);
+  /*
+   * 206이면 Content-Range의 시작 위치부터, 200이면 (Range 무시) 처음부터
+   * 보내야 할 위치(start)보다 뒤에서 시작하는 응답이면 중간이 빠지므로 보내지 않고 끊음
+   */
+  start = i * SEGMENT_SIZE > first ? i * SEGMENT_SIZE : first;
+  rio_readinitb(rio, serverfd);
+  off = -1;
+  if ((n = rio_readlineb(rio, buf, MAXLINE)) > 0)
+    off = parse_status(buf, n) == 206 ? -2 : parse_status(buf, n) == 200 ? 0 : -1;
+  while (off != -1 && (n = rio_readlineb(rio, buf, MAXLINE)) > 0 && strcmp(buf, endof_hdr) != 0)
+    if (off == -2 && strncasecmp(buf, "Content-Range:", 14) == 0 && (p = strstr(buf, "bytes ")) != NULL)
+      off = atol(p + 6);
+  if (off >= 0 && off <= start)
+    stream_segments(connfd, rio, request, off, total, start, last, buf, result);
   close(serverfd);
-}
\ No newline at end of file
+  return 0;
+}
+
+/* 응답 status line에서 상태 코드만 - HTTP/1.0 200 OK -> 200, 모르면 0 */
+int parse_status(const char *response, size_t len)
+{
+  const char *sp = memchr(response, ' ', len < 16 ? len : 16);
+  if (sp == NULL || sp + 4 > response + len)
+    return 0;
+  return atoi(sp + 1);
+}
@@ -0,0 +1,329 @@
+/*
+ * relay.c - 소켓 간 zero-copy 전달
+ *
+ * splice()는 GNU 확장이라 _GNU_SOURCE가 필요한데, csapp.h의 gai_error와
+ * netdb.h의 GNU 선언이 충돌하므로 csapp.h를 include하지 않는 별도 파일로 분리한다.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include "relay.h"
+
+#define RELAY_BUFSIZE 8192
+
+/* 완료 통지가 덜 온 채로 넘겨받은 소켓 - 통지가 다 오면 release(arg) */
+typedef struct deferred
+{
+  int fd;                    /* dup한 fd - 원래 fd가 닫혀도 error queue를 읽을 수 있도록 */
+  unsigned long pending;     /* 아직 통지가 안 온 sendmsg 수 */
+  void (*release)(void *);
+  void *arg;
+  struct deferred *next;
+} deferred_t;
+
+/* ------------ global var ------------ */
+static pthread_mutex_t d_lock = PTHREAD_MUTEX_INITIALIZER;
+static deferred_t *d_list;
+static int d_started;          /* reaper 스레드를 만들었으면 1 */
+
+/*
+ * fromfd -> pipe -> tofd 경로로 EOF까지 커널 안에서만 옮긴다. (user 메모리 복사 X)
+ * splice를 쓸 수 없는 fd면 read/write 루프로 대신한다.
+ * 리턴값 : tofd로 보낸 바이트 수, 에러 시 -1
+ */
+ssize_t relay_splice(int fromfd, int tofd)
+{
+  int pipefd[2];
+  ssize_t n, m, w, total;
+  char buf[RELAY_BUFSIZE];
+
+  total = 0;
+  if (pipe(pipefd) < 0)
+    goto fallback;
+
+  while (1)
+  {
+    n = splice(fromfd, NULL, pipefd[1], NULL, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n == 0) /* EOF */
+      break;
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      close(pipefd[0]);
+      close(pipefd[1]);
+      if (errno == EINVAL && total == 0)
+        goto fallback; /* splice 미지원 fd -> 일반 복사로 */
+      return -1;
+    }
+    /* 파이프에 들어온 만큼 전부 tofd 쪽으로 비운다 */
+    while (n > 0)
+    {
+      m = splice(pipefd[0], NULL, tofd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (m < 0 && errno == EINTR)
+        continue;
+      if (m <= 0)
+      {
+        /* 클라이언트 연결 끊김 */
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+      }
+      n -= m;
+      total += m;
+    }
+  }
+  close(pipefd[0]);
+  close(pipefd[1]);
+  return total;
+
+fallback:
+  while ((n = read(fromfd, buf, sizeof(buf))) != 0)
+  {
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    for (m = 0; m < n; m += w)
+    {
+      if ((w = write(tofd, buf + m, n - m)) < 0)
+      {
+        if (errno == EINTR)
+          w = 0;
+        else
+          return -1;
+      }
+    }
+    total += n;
+  }
+  return total;
+}
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+/*
+ * error queue에 와 있는 MSG_ZEROCOPY 완료 통지를 다 읽어서 *calls에서 뺌 (기다리지 않음)
+ * 리턴값 : 0, recvmsg 에러 -1
+ */
+static int zerocopy_drain(int fd, unsigned long *calls)
+{
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  struct sock_extended_err *ee;
+  unsigned long done;
+
+  while (*calls > 0)
+  {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN ? 0 : -1;
+    }
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+    {
+      ee = (struct sock_extended_err *)CMSG_DATA(cm);
+      if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+      /* [ee_info, ee_data] 구간의 sendmsg가 끝남 */
+      done = ee->ee_data - ee->ee_info + 1;
+      *calls = done < *calls ? *calls - done : 0;
+    }
+  }
+  return 0;
+}
+
+/*
+ * MSG_ZEROCOPY로 보낸 sendmsg calls번이 모두 끝났다는 통지를 ZEROCOPY_WAIT_MSEC까지 기다림
+ * 통지가 오기 전에는 커널이 아직 사용자 버퍼를 읽을 수 있어서 버퍼를 놓으면 안 된다.
+ * 리턴값 : 아직 통지가 안 온 수 (0이면 버퍼를 놓아도 됨)
+ */
+static unsigned long zerocopy_wait(int fd, unsigned long calls)
+{
+  struct pollfd pfd;
+  int n;
+
+  pfd.fd = fd;
+  pfd.events = 0; /* POLLERR는 항상 */
+  while (zerocopy_drain(fd, &calls) == 0 && calls > 0)
+  {
+    if ((n = poll(&pfd, 1, ZEROCOPY_WAIT_MSEC)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+  }
+  return calls;
+}
+
+/*
+ * reaper 스레드 - 넘겨받은 소켓들의 error queue를 ZEROCOPY_REAP_MSEC마다 훑어서
+ * 통지가 다 온 것은 닫고 버퍼를 놓는다. (release는 lock 밖에서)
+ */
+static void *zerocopy_reaper(void *vargp)
+{
+  deferred_t **pp, *d, *done;
+
+  while (1)
+  {
+    poll(NULL, 0, ZEROCOPY_REAP_MSEC);
+    done = NULL;
+    pthread_mutex_lock(&d_lock);
+    for (pp = &d_list; (d = *pp) != NULL;)
+    {
+      zerocopy_drain(d->fd, &d->pending);
+      if (d->pending > 0)
+      {
+        pp = &d->next;
+        continue;
+      }
+      *pp = d->next;
+      d->next = done;
+      done = d;
+    }
+    pthread_mutex_unlock(&d_lock);
+    for (; done != NULL; done = d)
+    {
+      d = done->next;
+      close(done->fd);
+      done->release(done->arg);
+      free(done);
+    }
+  }
+  return NULL;
+}
+#endif
+
+/*
+ * relay_sendv가 pending > 0으로 끝난 소켓을 넘겨받아 통지가 다 오면 release(arg)
+ * 그때까지 버퍼는 살려 둬야 하므로 release 안에서만 놓는다. fd로는 더 보내지 않는다 (FIN을 보냄)
+ * fd는 dup해서 들고 있으므로 부른 쪽은 평소처럼 닫아도 됨
+ * 클라이언트가 받지 않고 버티면 TCP_USER_TIMEOUT으로 커널이 연결을 끊고, 그때 통지가 온다.
+ * 리턴값 : 0, 넘기지 못하면 -1 (그러면 버퍼를 놓을 때를 알 수 없음)
+ */
+int relay_defer(int fd, unsigned long pending, void (*release)(void *), void *arg)
+{
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+  deferred_t *d;
+  pthread_t tid;
+  unsigned int timeout = ZEROCOPY_DEFER_TIMEOUT_MSEC;
+
+  if ((d = malloc(sizeof(deferred_t))) == NULL)
+    return -1;
+  if ((d->fd = dup(fd)) < 0)
+  {
+    free(d);
+    return -1;
+  }
+  setsockopt(d->fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+  shutdown(d->fd, SHUT_WR);
+  d->pending = pending;
+  d->release = release;
+  d->arg = arg;
+
+  pthread_mutex_lock(&d_lock);
+  if (!d_started)
+  {
+    if (pthread_create(&tid, NULL, zerocopy_reaper, NULL) != 0)
+    {
+      pthread_mutex_unlock(&d_lock);
+      close(d->fd);
+      free(d);
+      return -1;
+    }
+    pthread_detach(tid);
+    d_started = 1;
+  }
+  d->next = d_list;
+  d_list = d;
+  pthread_mutex_unlock(&d_lock);
+  return 0;
+#else
+  (void)fd;
+  (void)pending;
+  (void)release;
+  (void)arg;
+  return -1;
+#endif
+}
+
+/*
+ * iov 전체를 sendmsg 한 번에 (짧게 써지면 남은 부분부터 다시) - iov는 보내면서 고쳐 씀
+ * zerocopy면 MSG_ZEROCOPY로 보내고 커널이 버퍼를 다 쓸 때까지 기다렸다가 리턴한다.
+ * 소켓이 MSG_ZEROCOPY를 지원하지 않으면 보통 sendmsg로
+ * *pending : 기다려도 완료 통지가 안 온 sendmsg 수 - 0이 아니면 iov의 버퍼 (헤더 포함)를
+ *            놓지 말고 relay_defer로 넘겨야 한다.
+ * 리턴값 : 보낸 바이트 수, 에러 시 -1
+ */
+ssize_t relay_sendv(int fd, struct iovec *iov, int iovcnt, int zerocopy, unsigned long *pending)
+{
+  struct msghdr msg;
+  ssize_t n, total;
+  unsigned long calls;
+  int flags, one;
+
+  flags = 0;
+  calls = 0;
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+  one = 1;
+  if (zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+    flags = MSG_ZEROCOPY;
+#else
+  (void)one;
+  (void)zerocopy;
+#endif
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  total = 0;
+  while (msg.msg_iovlen > 0)
+  {
+    if ((n = sendmsg(fd, &msg, flags)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS && flags != 0)
+      {
+        flags = 0; /* 고정할 수 있는 페이지 한도 초과 -> 복사로 */
+        continue;
+      }
+      total = -1;
+      break;
+    }
+    if (flags != 0)
+      calls++;
+    total += n;
+    /* 다 보낸 iov는 건너뛰고, 걸쳐 있는 iov는 보낸 만큼 앞을 잘라냄 */
+    while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len)
+    {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0)
+    {
+      msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+  if (calls > 0)
+    calls = zerocopy_wait(fd, calls);
+#endif
+  *pending = calls;
+  return total;
+}
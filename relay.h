@@ -0,0 +1,23 @@
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* splice 한 번에 옮길 최대 바이트 수 (파이프 기본 용량 64KB) */
+#define SPLICE_CHUNK 65536
+
+/* 이보다 큰 body만 MSG_ZEROCOPY로 (작으면 페이지 고정 + 완료 통지 비용이 복사보다 큼) */
+#define ZEROCOPY_MIN 16384
+/* 완료 통지를 보낸 스레드에서 기다리는 최대 시간 - 넘으면 relay_defer로 넘겨 reaper 스레드가 마저 기다림 */
+#define ZEROCOPY_WAIT_MSEC 10000
+/* relay_defer로 넘긴 소켓의 TCP_USER_TIMEOUT - 클라이언트가 이만큼 ACK를 안 하면 커널이 끊고 버퍼를 놓음 */
+#define ZEROCOPY_DEFER_TIMEOUT_MSEC 60000
+/* reaper 스레드가 넘겨받은 소켓들의 error queue를 훑는 간격 */
+#define ZEROCOPY_REAP_MSEC 100
+
+ssize_t relay_splice(int fromfd, int tofd);
+ssize_t relay_sendv(int fd, struct iovec *iov, int iovcnt, int zerocopy, unsigned long *pending);
+int relay_defer(int fd, unsigned long pending, void (*release)(void *), void *arg);
+
+#endif
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "cache.h"
+
+#define SNAP_MAGIC "PXSNAP1"
+#define SNAP_ALIGN 8
+
+/*
+ * 파일 = 헤더 + 레코드 * count
+ * 레코드 = srec_t + key + value (8바이트 정렬)
+ * 메모리 캐시의 오래된 노드(tail)부터 저장
+ */
+typedef struct {
+    char magic[8];
+    uint64_t count;
+    uint64_t bytes;       /* 헤더 포함 파일 전체 크기 */
+} shdr_t;
+
+typedef struct {
+    uint32_t key_len;
+    uint32_t pad;
+    uint64_t size;
+    uint64_t sum;         /* key + value의 FNV-1a */
+} srec_t;
+
+/* 읽어 들인 스냅샷의 index 항목 - rec은 mmap 영역 안을 가리킴 */
+enum { SNAP_UNCHECKED = 0, SNAP_USED, SNAP_BAD, SNAP_KEEP /* 저장 중 표시 */ };
+typedef struct sent {
+    uint64_t hash;
+    const srec_t *rec;
+    int state;
+    struct sent *next;
+} sent_t;
+
+/* 저장할 때 쓰는 버퍼 */
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    long count;
+} sbuf_t;
+
+/* ------------ global var ------------ */
+static int snap_on;
+static const char *snap_map;
+static size_t snap_map_len;
+static sent_t **snap_index, *snap_ents;
+static size_t snap_nbuckets;
+static long snap_loaded, snap_hits, snap_corrupt, snap_saves;
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t snap_save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ------------ routine ------------ */
+static uint64_t snap_fnv(uint64_t h, const char *p, size_t len) {
+  while (len--)
+    h = (h ^ (unsigned char)*p++) * 0x100000001b3ULL;
+  return h;
+}
+#define SNAP_FNV_INIT 0xcbf29ce484222325ULL
+
+static size_t snap_reclen(size_t key_len, size_t size) {
+  return (sizeof(srec_t) + key_len + size + SNAP_ALIGN - 1) & ~(size_t)(SNAP_ALIGN - 1);
+}
+
+/*
+ * 시작할 때 한 번 : path를 mmap하고 레코드 헤더만 훑어서 index를 만든다.
+ * 파일이 없으면 0 (처음 시작), 형식이 틀리면 -1
+ * 리턴값 : 읽은 항목 수
+ */
+int snap_load(const char *path) {
+  int fd;
+  struct stat sb;
+  const shdr_t *hdr;
+  const srec_t *rec;
+  const char *key;
+  size_t pos, len;
+  uint64_t i, b;
+
+  snap_on = 1;
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return 0;
+  if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(shdr_t)) {
+    close(fd);
+    return -1;
+  }
+  snap_map_len = sb.st_size;
+  snap_map = mmap(NULL, snap_map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); /* mapping은 fd를 닫아도 유지됨 - 다음 저장이 rename으로 파일을 바꿔도 그대로 */
+  if (snap_map == MAP_FAILED) {
+    snap_map = NULL;
+    return -1;
+  }
+  hdr = (const shdr_t *)snap_map;
+  /* count는 파일에 들어갈 수 있는 레코드 수 이하여야 (깨진 헤더로 index 크기가 넘치지 않도록) */
+  if (memcmp(hdr->magic, SNAP_MAGIC, 8) != 0 || hdr->bytes != snap_map_len
+      || hdr->count > (snap_map_len - sizeof(shdr_t)) / sizeof(srec_t))
+    goto bad;
+
+  snap_nbuckets = hdr->count * 2 + 1;
+  snap_index = calloc(snap_nbuckets, sizeof(sent_t *));
+  snap_ents = calloc(hdr->count + 1, sizeof(sent_t));
+  if (snap_index == NULL || snap_ents == NULL) {
+    free(snap_index);
+    free(snap_ents);
+    snap_index = NULL;
+    snap_ents = NULL;
+    goto bad;
+  }
+  pos = sizeof(shdr_t);
+  for (i = 0; i < hdr->count; i++) {
+    rec = (const srec_t *)(snap_map + pos);
+    /* key_len, size를 따로 먼저 확인해야 snap_reclen이 넘쳐서 작은 값이 되지 않음 */
+    if (pos + sizeof(srec_t) > snap_map_len
+        || rec->key_len > snap_map_len - pos || rec->size > snap_map_len - pos
+        || (len = snap_reclen(rec->key_len, rec->size)) > snap_map_len - pos)
+      break; /* 잘린 파일 - 여기까지만 */
+    key = (const char *)(rec + 1);
+    snap_ents[i].hash = snap_fnv(SNAP_FNV_INIT, key, rec->key_len);
+    snap_ents[i].rec = rec;
+    /* 나중 레코드(더 최근)가 같은 key를 가리면 chain 앞쪽에서 먼저 찾힘 */
+    b = snap_ents[i].hash % snap_nbuckets;
+    snap_ents[i].next = snap_index[b];
+    snap_index[b] = &snap_ents[i];
+    pos += len;
+  }
+  snap_loaded = i;
+  return i;
+
+bad:
+  munmap((void *)snap_map, snap_map_len);
+  snap_map = NULL;
+  return -1;
+}
+
+int snap_enabled(void) {
+  return snap_on;
+}
+
+/*
+ * 스냅샷에서 key 찾기 (메모리 miss일 때)
+ * 처음 찾힌 항목만 checksum을 확인하고, 한 번 쓴 항목은 메모리 캐시가 가져갔으니 다시 주지 않는다.
+ * 리턴값 : value에 복사한 바이트 수, 없으면 0
+ */
+size_t snap_get(const char *key, char *value, size_t max) {
+  size_t key_len = strlen(key);
+  uint64_t h;
+  sent_t *e;
+  const char *k;
+  size_t size = 0;
+
+  if (snap_index == NULL)
+    return 0;
+  h = snap_fnv(SNAP_FNV_INIT, key, key_len);
+
+  pthread_mutex_lock(&snap_lock);
+  for (e = snap_index[h % snap_nbuckets]; e != NULL; e = e->next) {
+    k = (const char *)(e->rec + 1);
+    if (e->hash == h && e->rec->key_len == key_len && memcmp(k, key, key_len) == 0)
+      break;
+  }
+  if (e != NULL && e->state == SNAP_UNCHECKED) {
+    if (e->rec->size > max || snap_fnv(snap_fnv(SNAP_FNV_INIT, k, key_len), k + key_len, e->rec->size) != e->rec->sum) {
+      e->state = SNAP_BAD;
+      snap_corrupt++;
+    }
+    else {
+      size = e->rec->size;
+      memcpy(value, k + key_len, size);
+      e->state = SNAP_USED;
+      snap_hits++;
+    }
+  }
+  pthread_mutex_unlock(&snap_lock);
+  return size;
+}
+
+static int sbuf_append(sbuf_t *sb, const char *key, size_t key_len, const char *value, size_t size, uint64_t sum) {
+  size_t len = snap_reclen(key_len, size);
+  srec_t rec = {key_len, 0, size, sum};
+  char *tmp;
+
+  if (sb->len + len > sb->cap) {
+    sb->cap = (sb->len + len) * 2;
+    if ((tmp = realloc(sb->buf, sb->cap)) == NULL)
+      return -1;
+    sb->buf = tmp;
+  }
+  memcpy(sb->buf + sb->len, &rec, sizeof(rec));
+  memcpy(sb->buf + sb->len + sizeof(rec), key, key_len);
+  memcpy(sb->buf + sb->len + sizeof(rec) + key_len, value, size);
+  memset(sb->buf + sb->len + sizeof(rec) + key_len + size, 0, len - sizeof(rec) - key_len - size);
+  sb->len += len;
+  sb->count++;
+  return 0;
+}
+
+/* cache_walk 콜백 - writer lock 안이므로 memcpy만 */
+static void snap_collect(const char *key, const char *value, size_t size, void *arg) {
+  size_t key_len = strlen(key);
+  sbuf_append(arg, key, key_len, value, size,
+              snap_fnv(snap_fnv(SNAP_FNV_INIT, key, key_len), value, size));
+}
+
+/*
+ * 지금 캐시 내용을 path에 저장
+ * 1) writer lock 안에서 메모리 캐시 노드를 버퍼로 복사 (오래된 것부터)
+ * 2) 아직 메모리로 안 올라간 이전 스냅샷 항목을 캐시 용량까지 앞에 덧붙임 (더 오래된 것)
+ * 3) path.tmp에 쓰고 fsync 후 rename -> 도중에 죽어도 이전 스냅샷은 멀쩡함
+ */
+int snap_save(const char *path) {
+  sbuf_t old = {NULL, 0, 0, 0}, cur = {NULL, 0, 0, 0};
+  shdr_t hdr;
+  cache_stats_t cst;
+  char tmp[4096];
+  size_t budget, used = 0, off;
+  long i;
+  int fd, rc = -1;
+  ssize_t n;
+
+  pthread_mutex_lock(&snap_save_lock);
+  cache_walk(snap_collect, &cur);
+  cache_stats(&cst);
+  budget = cst.capacity > cur.len ? cst.capacity - cur.len : 0;
+
+  /* 스냅샷에서 못 쓴 항목 - 최근 것(뒤쪽)부터 budget만큼 */
+  pthread_mutex_lock(&snap_lock);
+  for (i = snap_loaded - 1; i >= 0 && snap_index != NULL; i--) {
+    const srec_t *r = snap_ents[i].rec;
+    if (snap_ents[i].state != SNAP_UNCHECKED)
+      continue;
+    if (used + snap_reclen(r->key_len, r->size) > budget)
+      break;
+    used += snap_reclen(r->key_len, r->size);
+    snap_ents[i].state = SNAP_KEEP; /* 표시만 해 두고 아래에서 오래된 순서대로 */
+  }
+  for (i = 0; i < snap_loaded && snap_index != NULL; i++)
+    if (snap_ents[i].state == SNAP_KEEP) {
+      const srec_t *r = snap_ents[i].rec;
+      sbuf_append(&old, (const char *)(r + 1), r->key_len, (const char *)(r + 1) + r->key_len, r->size, r->sum);
+      snap_ents[i].state = SNAP_UNCHECKED;
+    }
+  pthread_mutex_unlock(&snap_lock);
+
+  memcpy(hdr.magic, SNAP_MAGIC, 8);
+  hdr.count = old.count + cur.count;
+  hdr.bytes = sizeof(hdr) + old.len + cur.len;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+    goto out;
+  if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    goto out_close;
+  for (off = 0; off < old.len; off += n)
+    if ((n = write(fd, old.buf + off, old.len - off)) <= 0)
+      goto out_close;
+  for (off = 0; off < cur.len; off += n)
+    if ((n = write(fd, cur.buf + off, cur.len - off)) <= 0)
+      goto out_close;
+  if (fsync(fd) == 0 && close(fd) == 0 && rename(tmp, path) == 0) {
+    rc = 0;
+    snap_saves++;
+  }
+  fd = -1;
+out_close:
+  if (fd >= 0)
+    close(fd);
+  if (rc < 0)
+    unlink(tmp);
+out:
+  free(old.buf);
+  free(cur.buf);
+  pthread_mutex_unlock(&snap_save_lock);
+  return rc;
+}
+
+/*
+ * 아직 메모리로 안 올라간 항목 중 match에 걸리는 것을 버림 표시 (캐시 purge)
+ * 버린 항목은 다시 주지도, 다음 스냅샷에 옮겨 적지도 않는다.
+ * 리턴값 : 버린 항목 수
+ */
+long snap_purge(int (*match)(const char *key, size_t key_len, const char *value, size_t size, void *arg), void *arg) {
+  const char *k;
+  long i, n = 0;
+
+  pthread_mutex_lock(&snap_lock);
+  for (i = 0; i < snap_loaded && snap_index != NULL; i++) {
+    k = (const char *)(snap_ents[i].rec + 1);
+    if (snap_ents[i].state == SNAP_UNCHECKED &&
+        match(k, snap_ents[i].rec->key_len, k + snap_ents[i].rec->key_len, snap_ents[i].rec->size, arg)) {
+      snap_ents[i].state = SNAP_BAD;
+      n++;
+    }
+  }
+  pthread_mutex_unlock(&snap_lock);
+  return n;
+}
+
+void snap_stats(snap_stats_t *st) {
+  pthread_mutex_lock(&snap_lock);
+  st->loaded = snap_loaded;
+  st->hits = snap_hits;
+  st->corrupt = snap_corrupt;
+  pthread_mutex_unlock(&snap_lock);
+  st->saves = snap_saves;
+}
@@ -0,0 +1,27 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+
+/*
+ * 캐시 스냅샷 (warm restart)
+ * 종료할 때 / 주기적으로 메모리 캐시 내용을 파일 하나로 저장하고,
+ * 다음에 시작할 때 그 파일을 mmap해서 key index만 만든다.
+ * 내용 검증(checksum)은 그 객체가 처음 hit될 때 하고, 통과하면 메모리 캐시로 올린다.
+ */
+
+typedef struct snap_stats {
+    long loaded;          /* 시작할 때 읽은 스냅샷 항목 수 */
+    long hits;            /* 스냅샷에서 찾아 메모리로 올린 수 */
+    long corrupt;         /* checksum이 안 맞아 버린 수 */
+    long saves;           /* 저장 횟수 */
+} snap_stats_t;
+
+int    snap_load(const char *path);
+int    snap_enabled(void);
+size_t snap_get(const char *key, char *value, size_t max);
+int    snap_save(const char *path);
+long   snap_purge(int (*match)(const char *key, size_t key_len, const char *value, size_t size, void *arg), void *arg);
+void   snap_stats(snap_stats_t *st);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+#define TRACE_LINE_MAX 65536
+
+/* line에서 "name": 바로 뒤 위치, 없으면 NULL */
+static const char *json_field(const char *line, const char *name) {
+  char key[64];
+  const char *p;
+  snprintf(key, sizeof(key), "\"%s\"", name);
+  if ((p = strstr(line, key)) == NULL)
+    return NULL;
+  p += strlen(key);
+  while (*p == ' ' || *p == ':')
+    p++;
+  return p;
+}
+
+/* "..." JSON 문자열 -> malloc된 C 문자열 (\uXXXX는 ASCII 범위만) */
+static char *json_string(const char *p) {
+  char *out, *q;
+  if (p == NULL || *p++ != '"')
+    return NULL;
+  if ((out = q = malloc(strlen(p) + 1)) == NULL)
+    return NULL;
+  for (; *p != '\0' && *p != '"'; p++) {
+    if (*p != '\\') {
+      *q++ = *p;
+      continue;
+    }
+    switch (*++p) {
+    case 'n': *q++ = '\n'; break;
+    case 't': *q++ = '\t'; break;
+    case 'r': *q++ = '\r'; break;
+    case 'u':
+      if (strspn(p + 1, "0123456789abcdefABCDEF") < 4)
+        break; /* 잘렸거나 잘못된 escape - 버림 */
+      *q++ = (char)strtol((char[]){p[1], p[2], p[3], p[4], 0}, NULL, 16);
+      p += 4;
+      break;
+    case '\0': p--; break;
+    default: *q++ = *p;
+    }
+  }
+  *q = '\0';
+  return out;
+}
+
+/* 시각 순으로 정렬 (access log는 응답이 끝난 순서라 조금씩 섞여 있음) */
+static int cmp_ts(const void *a, const void *b) {
+  long x = ((const trace_rec_t *)a)->ts_usec, y = ((const trace_rec_t *)b)->ts_usec;
+  return (x > y) - (x < y);
+}
+
+/*
+ * path의 trace를 읽어 *recs에 시각 순으로 담는다.
+ * 리턴값 : 레코드 수, 파일을 못 열면 -1
+ */
+long trace_load(const char *path, trace_rec_t **recs) {
+  FILE *fp;
+  char *line;
+  const char *p;
+  trace_rec_t *r = NULL, *tmp;
+  long n = 0, cap = 0;
+
+  if ((fp = strcmp(path, "-") ? fopen(path, "r") : stdin) == NULL)
+    return -1;
+  line = malloc(TRACE_LINE_MAX);
+  while (fgets(line, TRACE_LINE_MAX, fp) != NULL) {
+    if (n == cap) {
+      cap = cap ? cap * 2 : 1024;
+      if ((tmp = realloc(r, cap * sizeof(trace_rec_t))) == NULL)
+        break;
+      r = tmp;
+    }
+    if ((r[n].url = json_string(json_field(line, "url"))) == NULL || r[n].url[0] == '\0') {
+      free(r[n].url);
+      continue; /* URL 없는 줄 (400 등)은 건너뜀 */
+    }
+    r[n].ts_usec = (p = json_field(line, "ts_usec")) ? atol(p) : n;
+    r[n].status = (p = json_field(line, "status")) ? atoi(p) : 200;
+    r[n].bytes = (p = json_field(line, "bytes")) ? atol(p) : 0;
+    n++;
+  }
+  free(line);
+  if (fp != stdin)
+    fclose(fp);
+  qsort(r, n, sizeof(trace_rec_t), cmp_ts);
+  *recs = r;
+  return n;
+}
+
+void trace_free(trace_rec_t *recs, long n) {
+  long i;
+  for (i = 0; i < n; i++)
+    free(recs[i].url);
+  free(recs);
+}
@@ -0,0 +1,19 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * 요청 trace - access log(-l)가 남기는 JSON lines 형식을 그대로 읽는다.
+ * {"ts_usec":..,"client":"..","url":"..","status":..,"bytes":..,"cache":"..","latency_usec":..}
+ * 필요한 필드(ts_usec, url, status, bytes)만 뽑고 나머지는 무시.
+ */
+typedef struct {
+    long ts_usec;   /* 요청 시각 (usec) */
+    char *url;      /* 요청 URL */
+    int status;     /* 응답 상태 코드 */
+    long bytes;     /* 응답 크기 */
+} trace_rec_t;
+
+long trace_load(const char *path, trace_rec_t **recs);
+void trace_free(trace_rec_t *recs, long n);
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <fcntl.h>
+#include "upstream.h"
+#include "csapp.h"
+
+/* backend 하나 - "host:port" */
+struct backend {
+    char name[MAXLINE];
+    char host[MAXLINE];
+    char port[8];
+    atomic_int up;             /* 0이면 뺀 상태 (ejected) */
+    atomic_long outstanding;   /* 지금 진행 중인 요청 수 */
+    atomic_long requests;      /* 연결한 요청 수 (누적) */
+    atomic_long ejections;     /* 뺀 횟수 (누적) */
+};
+
+/* pool 하나 - 요청 host[:port]가 name과 같으면 이 pool로 */
+typedef struct {
+    char name[MAXLINE];        /* "host" 또는 "host:port" */
+    int nbackends;
+    backend_t backends[UPSTREAM_MAX_BACKENDS];
+} pool_t;
+
+/* ------------ global var ------------ */
+static pool_t *u_pools[UPSTREAM_MAX_POOLS];
+static int u_npools;
+static atomic_uint u_seed = 2463534242u;
+
+static void *upstream_prober(void *vargp);
+
+/* ------------ routine ------------ */
+/*
+ * -u name=host:port,host:port,... 하나를 pool로 추가 (upstream_init 전에)
+ * 리턴값 : 형식이 틀렸거나 너무 많으면 -1
+ */
+int upstream_add(const char *spec) {
+  const char *eq = strchr(spec, '='), *p, *comma, *colon;
+  pool_t *pool;
+  backend_t *b;
+  size_t len;
+
+  if (eq == NULL || eq == spec || (size_t)(eq - spec) >= MAXLINE || u_npools == UPSTREAM_MAX_POOLS)
+    return -1;
+  if ((pool = calloc(1, sizeof(pool_t))) == NULL)
+    return -1;
+  memcpy(pool->name, spec, eq - spec);
+  for (p = eq + 1; *p != '\0'; p = *comma ? comma + 1 : comma) {
+    comma = p + strcspn(p, ",");
+    len = comma - p;
+    colon = memchr(p, ':', len);
+    if (pool->nbackends == UPSTREAM_MAX_BACKENDS || colon == NULL || colon == p ||
+        len >= MAXLINE || comma - colon - 1 >= 8 || comma - colon - 1 == 0) {
+      free(pool);
+      return -1;
+    }
+    b = &pool->backends[pool->nbackends++];
+    memcpy(b->name, p, len);
+    memcpy(b->host, p, colon - p);
+    memcpy(b->port, colon + 1, comma - colon - 1);
+    atomic_init(&b->up, 1);
+  }
+  if (pool->nbackends == 0) {
+    free(pool);
+    return -1;
+  }
+  u_pools[u_npools++] = pool;
+  return 0;
+}
+
+/* health probe 스레드 시작 */
+int upstream_init(void) {
+  pthread_t tid;
+
+  if (u_npools == 0)
+    return 0;
+  if (pthread_create(&tid, NULL, upstream_prober, NULL) != 0)
+    return -1;
+  pthread_detach(tid);
+  return 0;
+}
+
+/* 요청 host, port에 해당하는 pool 번호, 없으면 -1 (평소처럼 host에 직접 연결) */
+int upstream_find(const char *host, int port) {
+  char hostport[MAXLINE + 8];
+  int i;
+
+  if (u_npools == 0)
+    return -1;
+  snprintf(hostport, sizeof(hostport), "%s:%d", host, port);
+  for (i = 0; i < u_npools; i++)
+    if (strcasecmp(u_pools[i]->name, strchr(u_pools[i]->name, ':') ? hostport : host) == 0)
+      return i;
+  return -1;
+}
+
+/* 스레드 사이에 공유하는 xorshift - 순서가 섞여도 상관없음 */
+static unsigned rnd(void) {
+  unsigned x = atomic_load_explicit(&u_seed, memory_order_relaxed);
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  atomic_store_explicit(&u_seed, x, memory_order_relaxed);
+  return x;
+}
+
+static void eject(backend_t *b) {
+  if (atomic_exchange(&b->up, 0) == 1)
+    atomic_fetch_add(&b->ejections, 1);
+}
+
+/*
+ * 아직 안 해 본 backend 중 하나 고르기 (tried 비트)
+ * 살아 있는 것 중 두 개를 무작위로 뽑아 outstanding이 적은 쪽, 살아 있는 게 없으면 빠진 것 중에서
+ */
+static int pick(pool_t *pool, unsigned tried) {
+  int cand[UPSTREAM_MAX_BACKENDS], n = 0, i, ia, ib, a, b;
+
+  for (i = 0; i < pool->nbackends; i++)
+    if (!(tried & (1u << i)) && atomic_load(&pool->backends[i].up))
+      cand[n++] = i;
+  if (n == 0)
+    for (i = 0; i < pool->nbackends; i++)
+      if (!(tried & (1u << i)))
+        cand[n++] = i;
+  if (n == 0)
+    return -1;
+  if (n == 1)
+    return cand[0];
+  /* ib는 ia를 뺀 n - 1개 중에서 고르게 (ia 이상이면 하나 밀어서) */
+  ia = rnd() % n;
+  ib = rnd() % (n - 1);
+  if (ib >= ia)
+    ib++;
+  a = cand[ia];
+  b = cand[ib];
+  return atomic_load(&pool->backends[b].outstanding) < atomic_load(&pool->backends[a].outstanding) ? b : a;
+}
+
+/*
+ * pool의 backend 하나에 연결 - 실패한 backend는 빼고 다음 backend로
+ * 리턴값 : fd (*backend에 고른 backend, 끝나면 upstream_release), 모두 실패하면 -1
+ */
+int upstream_connect(int pool_idx, backend_t **backend) {
+  pool_t *pool = u_pools[pool_idx];
+  backend_t *b;
+  unsigned tried = 0;
+  int i, fd;
+
+  while ((i = pick(pool, tried)) >= 0) {
+    tried |= 1u << i;
+    b = &pool->backends[i];
+    atomic_fetch_add(&b->outstanding, 1);
+    if ((fd = open_clientfd(b->host, b->port)) >= 0) {
+      atomic_fetch_add(&b->requests, 1);
+      atomic_store(&b->up, 1);
+      *backend = b;
+      return fd;
+    }
+    atomic_fetch_sub(&b->outstanding, 1);
+    eject(b);
+  }
+  return -1;
+}
+
+void upstream_release(backend_t *backend) {
+  atomic_fetch_sub(&backend->outstanding, 1);
+}
+
+/* TCP 연결만 되는지 - timeout_ms 안에 안 되면 실패 (죽은 host에서 오래 막히지 않도록 non-blocking) */
+static int probe(backend_t *b, int timeout_ms) {
+  struct addrinfo hints, *list, *p;
+  struct pollfd pfd;
+  int fd, ok = 0, err;
+  socklen_t len;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+  if (getaddrinfo(b->host, b->port, &hints, &list) != 0)
+    return 0;
+  for (p = list; p != NULL && !ok; p = p->ai_next) {
+    if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+      continue;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+      ok = 1;
+    else if (errno == EINPROGRESS) {
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      len = sizeof(err);
+      if (poll(&pfd, 1, timeout_ms) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+        ok = 1;
+    }
+    close(fd);
+  }
+  freeaddrinfo(list);
+  return ok;
+}
+
+/* active health check - UPSTREAM_PROBE_SEC마다 모든 backend를 probe해서 up 갱신 */
+static void *upstream_prober(void *vargp) {
+  backend_t *b;
+  int i, j;
+
+  while (1) {
+    sleep(UPSTREAM_PROBE_SEC);
+    for (i = 0; i < u_npools; i++)
+      for (j = 0; j < u_pools[i]->nbackends; j++) {
+        b = &u_pools[i]->backends[j];
+        if (probe(b, UPSTREAM_PROBE_MSEC))
+          atomic_store(&b->up, 1);
+        else
+          eject(b);
+      }
+  }
+  return NULL;
+}
+
+/* metrics용 - backend별 gauge, counter */
+void upstream_render(FILE *f) {
+  static const char *names[] = {"proxy_upstream_up", "proxy_upstream_outstanding",
+                                "proxy_upstream_requests_total", "proxy_upstream_ejections_total"};
+  static const char *types[] = {"gauge", "gauge", "counter", "counter"};
+  backend_t *b;
+  long v;
+  int i, j, k;
+
+  if (u_npools == 0)
+    return;
+  for (k = 0; k < 4; k++) {
+    fprintf(f, "# TYPE %s %s\n", names[k], types[k]);
+    for (i = 0; i < u_npools; i++)
+      for (j = 0; j < u_pools[i]->nbackends; j++) {
+        b = &u_pools[i]->backends[j];
+        v = k == 0 ? atomic_load(&b->up) : k == 1 ? atomic_load(&b->outstanding) :
+            k == 2 ? atomic_load(&b->requests) : atomic_load(&b->ejections);
+        fprintf(f, "%s{pool=\"%s\",backend=\"%s\"} %ld\n", names[k], u_pools[i]->name, b->name, v);
+      }
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include <stdio.h>
+
+/*
+ * 엔드 서버 pool (load balancing)
+ * 요청 host가 -u로 설정한 이름과 같으면 그 host 대신 pool의 backend 중 하나에 연결한다.
+ * - 고르기 : 살아 있는 backend 두 개를 무작위로 뽑아 진행 중인 요청이 적은 쪽 (power of two choices)
+ * - passive : 연결에 실패한 backend는 바로 빼고 (ejection) 다른 backend로 다시 시도
+ * - active : 백그라운드 스레드가 UPSTREAM_PROBE_SEC마다 모든 backend에 TCP 연결을 해 보고
+ *            되면 다시 넣고, 안 되면 뺀다.
+ */
+
+#define UPSTREAM_MAX_POOLS 16
+#define UPSTREAM_MAX_BACKENDS 32      /* pool 하나당 */
+#define UPSTREAM_PROBE_SEC 2          /* health probe 주기 */
+#define UPSTREAM_PROBE_MSEC 1000      /* probe 연결 timeout */
+
+typedef struct backend backend_t;
+
+int  upstream_add(const char *spec);
+int  upstream_init(void);
+int  upstream_find(const char *host, int port);
+int  upstream_connect(int pool, backend_t **backend);
+void upstream_release(backend_t *backend);
+void upstream_render(FILE *f);
+
+#endif